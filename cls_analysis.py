@@ -70,6 +70,8 @@ def define_parser():
     parser.add_option("--bkgname", action="store", type = "string", dest = "bkgname")
     parser.add_option("--datname", action="store", type = "string", dest = "datname")
     parser.add_option("-b", action="store_true", dest = "suppress")
+    parser.add_option("--cache_dir", action="store", type = "string", dest = "cache_dir")
+    parser.add_option("--no_cache", action="store_true", dest = "no_cache")
     return parser
 
 
@@ -117,6 +119,9 @@ if __name__ == "__main__":
     signame = "signal"
     bkgname = "background"
     datname = "data"
+    # Prepared workspaces (with their fits) are cached here, keyed by the
+    # contents of the inputs.  An empty string turns the cache off.
+    cache_dir = ".ws_cache"
 
     graphics_string = ''
 
@@ -157,6 +162,12 @@ if __name__ == "__main__":
     if (options.suppress):
         graphics_string = '-b -q '
 
+    if (options.cache_dir != None):
+        cache_dir = options.cache_dir
+
+    if (options.no_cache):
+        cache_dir = ""
+
 
     workspace = "_workspacefrom_" + input_sig + input_bkg + input_dat
     infile = '\\"' + workspace + '\\"'
@@ -180,7 +191,7 @@ if __name__ == "__main__":
     gROOT.ProcessLine('.L workspace_preparer.C')
 
     # Now we can prepare the workspace.
-    workspace_preparer(input_sig, signame, input_bkg, bkgname, input_dat, datname, config_file_name, workspace)
+    workspace_preparer(input_sig, signame, input_bkg, bkgname, input_dat, datname, config_file_name, workspace, cache_dir)
 
     # As mentioned, gROOT.ProcessLine('.L StandardHypoTestInvDemo.C')
     # and then StandardHypoTestInvDemo() will cause errors because the 
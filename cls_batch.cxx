@@ -0,0 +1,351 @@
+/*
+ * Batch driver: computes the CLs limit for many signal hypotheses (mass
+ * points) that share the same background, data and config file.
+ *
+ * The workspace (background template, data, constraint terms) is
+ * prepared once, with the signal template of the first mass point.  For
+ * each other mass point only the signal template (unextended_sig_pdf) is
+ * replaced and the snapshot fits are redone (see replace_signal in
+ * workspace_preparer.C); the first one uses the snapshots as prepared.  The mass points run in
+ * parallel, in forked worker processes that share the prepared
+ * workspace, and their limits are collected in one table.
+ *
+ * The mass list has one mass point per line:
+ *
+ *   <mass> <signal file> <signal histogram name>
+ *
+ * Empty lines and lines starting with # are ignored.  Example:
+ *
+ *   ./cls_batch -l masses.txt --bfile uneven_background.root
+ *               --dfile uneven_data.root -c counting.cfg -n 5000 -p 9 -b -t 1
+ *
+ * Options (see cls_main.cxx for their meaning and defaults):
+ *   -c, -a, -t, -p, -n, -j, -b
+ *   --bfile, --dfile, --bkgname, --datname, --cache_dir, --no_cache
+ *   --adaptive, --tolerance, --max_points
+ *   --sequential, --batch_size, --stop_sigma
+ *   --shard, --nshards, --fast_nll, --fast_toys, --seed
+ *                        as in cls_analysis, for every mass point
+ *   --checkpoint base    the checkpoint of each mass point is <base>_<mass>.root
+ *   --profile base       the timing report of each mass point is <base>_<mass>
+ * plus:
+ *   -l, --mass_list      file with the mass points
+ *   -o, --output         result table (batch_limits.txt)
+ *   --jobs               mass points run at the same time (number of cores)
+ *
+ * The signal options of cls_analysis (--sfile, --signame) are replaced by
+ * the mass list, and --merge is not available: merge the shards of each
+ * mass point with cls_analysis --merge.
+ *
+ * The output of each mass point goes to <output>_<mass>.log.
+ */
+
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "TROOT.h"
+
+#include "workspace_preparer.C"
+#include "config_reader.cxx"
+#include "StandardHypoTestInvDemo.C"
+
+
+// Options that have no short form
+enum { kOptBFile = 256, kOptDFile, kOptBkgName, kOptDatName, kOptCacheDir,
+       kOptNoCache, kOptJobs, kOptAdaptive, kOptTolerance, kOptMaxPoints,
+       kOptSequential, kOptBatchSize, kOptStopSigma, kOptFastNLL, kOptFastToys,
+       kOptShard, kOptNShards, kOptCheckpoint, kOptSeed, kOptProfile };
+
+
+struct mass_point {
+  std::string mass;
+  std::string signal_file;
+  std::string signal_hist;
+};
+
+
+void print_usage(const char *prog){
+  std::cout << "Usage: " << prog << " -l mass_list [-o table] [--jobs n] "
+            << "[-c config] [-a calculatorType] [-t testStatType]\n"
+            << "       [-p points] [-n ntoys] [-j threads] [-b] "
+            << "[--bfile file] [--dfile file] [--bkgname name] [--datname name]\n"
+            << "       [--cache_dir dir] [--no_cache] [--adaptive] [--tolerance t] [--max_points n]\n"
+            << "       [--sequential] [--batch_size n] [--stop_sigma z]\n"
+            << "       [--shard k --nshards n] [--checkpoint base] [--fast_nll] [--fast_toys]\n"
+            << "       [--seed n] [--profile base]" << std::endl;
+}
+
+
+/*
+ * Reads the mass list.  Returns false if the file cannot be read or a
+ * line is malformed.
+ */
+bool read_mass_list(const std::string &file_name, std::vector<mass_point> &points){
+  std::ifstream list(file_name.c_str());
+  if (!list.is_open()){
+    std::cerr << "ERROR: cannot open the mass list " << file_name << std::endl;
+    return false;
+  }
+  std::string line;
+  while (getline(list, line)){
+    if (line.find_first_not_of(" \t") == std::string::npos) continue;
+    if (line[line.find_first_not_of(" \t")] == '#') continue;
+    std::istringstream fields(line);
+    mass_point point;
+    if (!(fields >> point.mass >> point.signal_file >> point.signal_hist)){
+      std::cerr << "ERROR: malformed line in " << file_name << ": " << line << std::endl;
+      return false;
+    }
+    points.push_back(point);
+  }
+  return true;
+}
+
+
+int main(int argc, char **argv){
+
+  // Set defaults for optional values (as in cls_analysis.py)
+  std::string config_file_name = "config.cfg";
+  int calculatorType = 0;
+  int testStatType = 3;
+  bool useCLs = true;
+  int npoints = 4;
+  double poimin = 0;
+  double poimax = 1000;
+  int ntoys = 1000;
+  bool useNumberCounting = false;
+
+  std::string input_bkg = "background.root";
+  std::string input_dat = "data.root";
+  std::string bkgname = "background";
+  std::string datname = "data";
+  bool suppress = false;
+  std::string cache_dir = ".ws_cache";
+
+  std::string mass_list;
+  std::string output = "batch_limits.txt";
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  std::string checkpoint_base;
+  std::string profile_base;
+
+  static struct option long_options[] = {
+    {"config_file_name",          required_argument, 0, 'c'},
+    {"calculatorType",            required_argument, 0, 'a'},
+    {"test_statistic_type",       required_argument, 0, 't'},
+    {"points",                    required_argument, 0, 'p'},
+    {"num_toys",                  required_argument, 0, 'n'},
+    {"threads",                   required_argument, 0, 'j'},
+    {"mass_list",                 required_argument, 0, 'l'},
+    {"output",                    required_argument, 0, 'o'},
+    {"jobs",                      required_argument, 0, kOptJobs},
+    {"bfile",                     required_argument, 0, kOptBFile},
+    {"background_histogram_file", required_argument, 0, kOptBFile},
+    {"dfile",                     required_argument, 0, kOptDFile},
+    {"data_histogram_file",       required_argument, 0, kOptDFile},
+    {"bkgname",                   required_argument, 0, kOptBkgName},
+    {"datname",                   required_argument, 0, kOptDatName},
+    {"cache_dir",                 required_argument, 0, kOptCacheDir},
+    {"no_cache",                  no_argument,       0, kOptNoCache},
+    {"adaptive",                  no_argument,       0, kOptAdaptive},
+    {"tolerance",                 required_argument, 0, kOptTolerance},
+    {"max_points",                required_argument, 0, kOptMaxPoints},
+    {"sequential",                no_argument,       0, kOptSequential},
+    {"batch_size",                required_argument, 0, kOptBatchSize},
+    {"stop_sigma",                required_argument, 0, kOptStopSigma},
+    {"fast_nll",                  no_argument,       0, kOptFastNLL},
+    {"fast_toys",                 no_argument,       0, kOptFastToys},
+    {"seed",                      required_argument, 0, kOptSeed},
+    {"profile",                   required_argument, 0, kOptProfile},
+    {"shard",                     required_argument, 0, kOptShard},
+    {"nshards",                   required_argument, 0, kOptNShards},
+    {"checkpoint",                required_argument, 0, kOptCheckpoint},
+    {"help",                      no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "c:a:t:p:n:j:l:o:bh", long_options, 0)) != -1){
+    switch (opt){
+    case 'c': config_file_name = optarg; break;
+    case 'a': calculatorType = atoi(optarg); break;
+    case 't': testStatType = atoi(optarg); break;
+    case 'p': npoints = atoi(optarg); break;
+    case 'n': ntoys = atoi(optarg); break;
+    case 'j': nthreads = atoi(optarg); break;
+    case 'l': mass_list = optarg; break;
+    case 'o': output = optarg; break;
+    case 'b': suppress = true; break;
+    case kOptJobs: jobs = atoi(optarg); break;
+    case kOptBFile: input_bkg = optarg; break;
+    case kOptDFile: input_dat = optarg; break;
+    case kOptBkgName: bkgname = optarg; break;
+    case kOptDatName: datname = optarg; break;
+    case kOptCacheDir: cache_dir = optarg; break;
+    case kOptNoCache: cache_dir = ""; break;
+    case kOptAdaptive: adaptiveScan = true; break;
+    case kOptTolerance: adaptiveTolerance = atof(optarg); break;
+    case kOptMaxPoints: adaptiveMaxPoints = atoi(optarg); break;
+    case kOptSequential: sequentialToys = true; break;
+    case kOptBatchSize: toyBatchSize = atoi(optarg); break;
+    case kOptStopSigma: stopSignificance = atof(optarg); break;
+    case kOptFastNLL: fastNLL = true; break;
+    case kOptFastToys: fastToys = true; break;
+    case kOptSeed: randomSeed = atoi(optarg); break;
+    case kOptProfile: profile_base = optarg; break;
+    case kOptShard: shardIndex = atoi(optarg); break;
+    case kOptNShards: nShards = atoi(optarg); break;
+    case kOptCheckpoint: checkpoint_base = optarg; break;
+    case 'h': print_usage(argv[0]); return 0;
+    default: print_usage(argv[0]); return 1;
+    }
+  }
+
+  std::vector<mass_point> points;
+  if (mass_list.empty() || !read_mass_list(mass_list, points) || points.empty()){
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (jobs < 1) jobs = 1;
+
+  // Workers never open graphics windows; the plots are saved to files.
+  gROOT->SetBatch(kTRUE);
+  if (!suppress)
+    std::cout << "Note: the batch driver always runs in batch mode" << std::endl;
+
+  // The shared part of the model is prepared once, with the first
+  // signal template (which the workers replace).
+  RooWorkspace *w = prepare_workspace(points[0].signal_file.c_str(),
+                                      points[0].signal_hist.c_str(),
+                                      input_bkg.c_str(), bkgname.c_str(),
+                                      input_dat.c_str(), datname.c_str(),
+                                      config_file_name.c_str(),
+                                      cache_dir.c_str());
+  if (!w){
+    std::cerr << "Could not prepare the workspace - Exit" << std::endl;
+    return 1;
+  }
+
+  std::vector<pid_t> pids(points.size(), -1);
+  std::vector<int> pipes(points.size(), -1);
+  int running = 0;
+
+  for (unsigned int i = 0; i < points.size(); i++){
+
+    // wait for a free slot
+    while (running >= jobs){
+      int status;
+      if (waitpid(-1, &status, 0) > 0) running--;
+      else break;
+    }
+
+    int fd[2];
+    if (pipe(fd) != 0){
+      std::cerr << "ERROR: cannot create a pipe for mass " << points[i].mass << std::endl;
+      continue;
+    }
+    std::cout << "Starting mass point " << points[i].mass << std::endl;
+    std::cout.flush();
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid == 0){
+      // worker: swap the signal template and run the calculator
+      close(fd[0]);
+      std::string log = output + "_" + points[i].mass + ".log";
+      if (freopen(log.c_str(), "w", stdout)) dup2(fileno(stdout), fileno(stderr));
+
+      int status = 1;
+      // the workspace already has the template and the snapshot fits of
+      // the first mass point
+      bool prepared = (i == 0);
+      if (!prepared){
+        TFile signal_file(points[i].signal_file.c_str());
+        TH2D *signal_hist = (TH2D *)signal_file.Get(points[i].signal_hist.c_str());
+        prepared = replace_signal(w, signal_hist);
+      }
+      if (prepared){
+        massValue = points[i].mass;   // tags the result file name
+        if (!checkpoint_base.empty())
+          checkpointFile = (checkpoint_base + "_" + points[i].mass + ".root").c_str();
+        if (!profile_base.empty())
+          profileFileName = (profile_base + "_" + points[i].mass).c_str();
+        std::string workspace = "_workspacefrom_" + points[i].signal_file + input_bkg + input_dat;
+        std::string cls_name = input_dat + "_" + points[i].mass + "_cls.ps";
+        std::string bells_name = input_dat + "_" + points[i].mass + "_bells.ps";
+        HypoTestInverterResult *r =
+          StandardHypoTestInvOnWorkspace(w, workspace.c_str(), "SbModel", "BModel",
+                                         "data", calculatorType, testStatType,
+                                         useCLs, npoints, poimin, poimax, ntoys,
+                                         useNumberCounting, 0,
+                                         cls_name.c_str(), bells_name.c_str());
+        if (r){
+          FILE *out = fdopen(fd[1], "w");
+          fprintf(out, "%s %g %g %g %g %g %g %g\n", points[i].mass.c_str(),
+                  r->UpperLimit(), r->UpperLimitEstimatedError(),
+                  r->GetExpectedUpperLimit(0), r->GetExpectedUpperLimit(-1),
+                  r->GetExpectedUpperLimit(1), r->GetExpectedUpperLimit(-2),
+                  r->GetExpectedUpperLimit(2));
+          fclose(out);
+          status = 0;
+        }
+      }
+      fflush(stdout);
+      // skip the global destructors: the parent owns the ROOT state
+      _exit(status);
+    }
+
+    close(fd[1]);
+    if (pid < 0){
+      std::cerr << "ERROR: cannot start a worker for mass " << points[i].mass << std::endl;
+      close(fd[0]);
+      continue;
+    }
+    pids[i] = pid;
+    pipes[i] = fd[0];
+    running++;
+  }
+
+  // wait for the remaining workers
+  while (running > 0){
+    int status;
+    if (waitpid(-1, &status, 0) > 0) running--;
+    else break;
+  }
+
+  // collect the results in the order of the mass list
+  std::ofstream table(output.c_str());
+  table << "# mass  limit  limit_error  expected_median  expected_-1sig  "
+        << "expected_+1sig  expected_-2sig  expected_+2sig" << std::endl;
+  int nfailed = 0;
+  for (unsigned int i = 0; i < points.size(); i++){
+    std::string line;
+    if (pipes[i] >= 0){
+      char buffer[512];
+      ssize_t n;
+      while ((n = read(pipes[i], buffer, sizeof(buffer))) > 0)
+        line.append(buffer, n);
+      close(pipes[i]);
+    }
+    if (line.empty()){
+      table << points[i].mass << " failed" << std::endl;
+      nfailed++;
+    }
+    else table << line;
+  }
+  table.close();
+
+  std::cout << "Limits for " << points.size() - nfailed << " of " << points.size()
+            << " mass points written to " << output << std::endl;
+
+  delete w;
+  return (nfailed == 0) ? 0 : 1;
+}
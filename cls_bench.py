@@ -0,0 +1,192 @@
+# Benchmark of the compiled CLs calculator (cls_analysis, see cls_main.cxx)
+# on the sample inputs (uneven_*.root with counting.cfg).
+#
+# Every configuration (calculator type x test statistic x number of
+# threads, where 0 threads is the RooStats toy loop) is run with the same
+# random seed, and the timing report that cls_analysis writes (see
+# profiler.h) is read back.  For each configuration the script reports:
+#   time_to_limit   wall time of the whole run, in seconds
+#   scan            time of the limit scan, in seconds
+#   workers         threads or worker processes that ran the toys (0 for
+#                   the RooStats toy loop), as reported by cls_analysis
+#   toys            toys run in the scan
+#   toys_per_s      toys / scan time
+#   limit           the observed upper limit (to check that the
+#                   configurations agree)
+# Configurations that ran with another number of workers than asked for
+# are marked with a "*" and listed at the end.
+#
+# Each configuration runs in its own directory, <output_dir>/<name>, which
+# gets its log, timing report, result file and plots.  The output
+# directory is bench/<date>_<time> unless --output_dir is given, so runs
+# do not overwrite each other.  The table is printed and written to
+# <output_dir>/bench_results.csv.  Run it with "make bench", or e.g.
+#
+#   python cls_bench.py -n 200 -p 5 --threads 0,4 --calculators 0,2 --fast
+#
+# The workspace is built once (in <output_dir>/ws_cache) before the timed
+# runs, so the times do not include the snapshot fits of
+# workspace_preparer.
+
+import os
+import sys
+import json
+import time
+import subprocess
+from optparse import OptionParser
+
+
+def define_parser():
+    parser = OptionParser()
+    parser.add_option("-n", "--num_toys", action="store", type="int", dest="ntoys", default=200)
+    parser.add_option("-p", "--points", action="store", type="int", dest="npoints", default=5)
+    parser.add_option("--seed", action="store", type="int", dest="seed", default=12345)
+    parser.add_option("--calculators", action="store", type="string", dest="calculators", default="0,1,2")
+    parser.add_option("--test_statistics", action="store", type="string", dest="test_statistics", default="1,3")
+    parser.add_option("--threads", action="store", type="string", dest="threads", default="0,1,2,4")
+    parser.add_option("--fast", action="store_true", dest="fast", default=False,
+                      help="also run each toy configuration with --fast_nll --fast_toys")
+    parser.add_option("--output_dir", action="store", type="string", dest="output_dir", default=None,
+                      help="directory of the results (default bench/<date>_<time>)")
+    parser.add_option("--program", action="store", type="string", dest="program", default="./cls_analysis")
+    return parser
+
+
+# The sample inputs.  cls_analysis names its plots after the data file,
+# so the inputs are linked into the directory of each configuration and
+# passed without a path.
+INPUTS = ["uneven_signal.root", "uneven_background.root", "uneven_data.root", "counting.cfg"]
+
+
+# The fixed part of the command line.
+def base_command(options):
+    return [os.path.abspath(options.program),
+            "--sfile", INPUTS[0],
+            "--bfile", INPUTS[1],
+            "--dfile", INPUTS[2],
+            "-c", INPUTS[3],
+            "--cache_dir", os.path.abspath(os.path.join(options.output_dir, "ws_cache")),
+            "-b",
+            "--seed", str(options.seed)]
+
+
+# All (name, extra arguments, threads) configurations to run.  The
+# asymptotic calculator runs no toys, so it is run once per test statistic
+# (with threads None).
+def configurations(options):
+    configs = []
+    variants = [("", [])]
+    if options.fast:
+        variants.append(("_fast", ["--fast_nll", "--fast_toys"]))
+    for calc in [int(c) for c in options.calculators.split(",")]:
+        for ts in [int(t) for t in options.test_statistics.split(",")]:
+            if calc == 2:
+                configs.append(("a2_t%d" % ts,
+                                ["-a", "2", "-t", str(ts), "-p", str(options.npoints)], None))
+                continue
+            for threads in [int(j) for j in options.threads.split(",")]:
+                for suffix, extra in variants:
+                    configs.append(("a%d_t%d_j%d%s" % (calc, ts, threads, suffix),
+                                    ["-a", str(calc), "-t", str(ts), "-j", str(threads),
+                                     "-p", str(options.npoints), "-n", str(options.ntoys)] + extra,
+                                    threads))
+    return configs
+
+
+# Runs one configuration in <output_dir>/<name>; returns a dictionary with
+# the measured values.
+def run_configuration(options, name, args):
+    run_dir = os.path.join(options.output_dir, name)
+    if not os.path.isdir(run_dir):
+        os.makedirs(run_dir)
+    for name_in in INPUTS:
+        link = os.path.join(run_dir, name_in)
+        if not os.path.exists(link):
+            os.symlink(os.path.abspath(name_in), link)
+    profile = os.path.join(run_dir, "profile")
+    log_name = os.path.join(run_dir, name + ".log")
+    command = base_command(options) + args + ["--profile", os.path.abspath(profile)]
+    start = time.time()
+    with open(log_name, "w") as log:
+        status = subprocess.call(command, stdout=log, stderr=subprocess.STDOUT, cwd=run_dir)
+    wall = time.time() - start
+
+    result = {"name": name, "status": status, "time_to_limit": wall,
+              "scan": None, "workers": None, "toys": None, "toys_per_s": None, "limit": None}
+    if status != 0 or not os.path.exists(profile + ".json"):
+        return result
+    with open(profile + ".json") as f:
+        report = json.load(f)
+    for timer in report["timers"]:
+        if timer["name"] == "limit_scan":
+            result["scan"] = timer["total_s"]
+    toys = report["counters"].get("toys", 0)
+    if toys > 0:
+        result["toys"] = toys
+        if result["scan"]:
+            result["toys_per_s"] = toys / result["scan"]
+    result["limit"] = report["values"].get("upper_limit")
+    workers = report["values"].get("toy_workers")
+    if workers is not None:
+        result["workers"] = int(workers)
+    return result
+
+
+def format_value(value, fmt):
+    if value is None:
+        return "-"
+    return fmt % value
+
+
+def main():
+    parser = define_parser()
+    (options, args) = parser.parse_args()
+
+    if not os.path.exists(options.program):
+        sys.stderr.write("ERROR: %s not found - run make first\n" % options.program)
+        return 1
+    if options.output_dir is None:
+        options.output_dir = os.path.join("bench", time.strftime("%Y%m%d_%H%M%S"))
+    sys.stdout.write("Writing the results in %s\n" % options.output_dir)
+    if not os.path.isdir(options.output_dir):
+        os.makedirs(options.output_dir)
+
+    # build the workspace cache (not timed)
+    sys.stdout.write("Preparing the workspace\n")
+    run_configuration(options, "warmup", ["-a", "2", "-t", "3", "-p", "2"])
+
+    columns = ["name", "status", "time_to_limit", "scan", "workers", "toys", "toys_per_s", "limit"]
+    formats = ["%s", "%d", "%.2f", "%.2f", "%d", "%d", "%.1f", "%.5g"]
+    results = []
+    sys.stdout.write("%-20s %6s %14s %10s %8s %8s %12s %12s\n" % tuple(columns))
+    for name, extra, threads in configurations(options):
+        r = run_configuration(options, name, extra)
+        # asked for threads, but ran with another number of workers
+        r["mismatch"] = (threads is not None and r["status"] == 0 and r["workers"] != threads)
+        results.append(r)
+        values = [format_value(r[c], f) for c, f in zip(columns, formats)]
+        if r["mismatch"]:
+            values[4] += "*"
+        sys.stdout.write("%-20s %6s %14s %10s %8s %8s %12s %12s\n" % tuple(values))
+        sys.stdout.flush()
+
+    table_name = os.path.join(options.output_dir, "bench_results.csv")
+    with open(table_name, "w") as table:
+        table.write(",".join(columns) + "\n")
+        for r in results:
+            table.write(",".join([format_value(r[c], f) for c, f in zip(columns, formats)]) + "\n")
+    sys.stdout.write("Results written to %s\n" % table_name)
+
+    mismatched = [r["name"] for r in results if r["mismatch"]]
+    if mismatched:
+        sys.stderr.write("Not run with the requested number of threads: %s\n" % " ".join(mismatched))
+
+    failed = [r["name"] for r in results if r["status"] != 0]
+    if failed:
+        sys.stderr.write("Failed configurations: %s\n" % " ".join(failed))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
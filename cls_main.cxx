@@ -0,0 +1,223 @@
+/*
+ * Compiled entry point for the CLs calculator.  It does the same job as
+ * cls_analysis.py, and takes the same options, but in a single process:
+ * the workspace built by prepare_workspace() (workspace_preparer.C) is
+ * handed in memory to the HypoTestInvTool (StandardHypoTestInvDemo.C),
+ * instead of being written to disk and read back by a second,
+ * interpreted ROOT session.
+ *
+ * Build it with "make", then run e.g.
+ *
+ *   ./cls_analysis --sfile uneven_signal.root --bfile uneven_background.root
+ *                  --dfile uneven_data.root -c counting.cfg -n 5000 -p 9 -b -t 1
+ *
+ * Options (defaults are the ones of cls_analysis.py):
+ *   -c, --config_file_name        config file (config.cfg)
+ *   -a, --calculatorType          calculator type (0)
+ *   -t, --test_statistic_type     test statistic type (3)
+ *   -p, --points                  number of scan points (4)
+ *   -n, --num_toys                number of toys (1000)
+ *   --sfile, --signal_histogram_file       (signal.root)
+ *   --bfile, --background_histogram_file   (background.root)
+ *   --dfile, --data_histogram_file         (data.root)
+ *   --signame, --bkgname, --datname        names of the objects in the files
+ *   -b                            batch mode (no graphics windows)
+ *   -j, --threads                 threads for the toys (0 = RooStats toy loop)
+ *   --cache_dir                   workspace cache directory (.ws_cache)
+ *   --no_cache                    always rebuild the workspace and its fits
+ *   --adaptive                    place the toy points around the asymptotic
+ *                                 limit instead of on -p points (-a 0 or 1)
+ *   --tolerance                   relative limit error where --adaptive stops (0.02)
+ *   --max_points                  maximum number of --adaptive points (20)
+ *   --sequential                  run the toys of each point in batches and stop
+ *                                 when CLs is resolved (-n is then the maximum)
+ *   --batch_size                  S+B toys per --sequential batch (500)
+ *   --stop_sigma                  stop when |CLs - 0.05| > stop_sigma * error (3)
+ *   --shard, --nshards            run shard k (0 ... n-1) of n: -n toys per point
+ *                                 with their own seeds (fixed scan, -a 0 or 1)
+ *   --checkpoint                  save the toys in this file after each batch,
+ *                                 and resume from it if it exists (it must have
+ *                                 been written with the same options and shard)
+ *   --fast_nll                    binned razor likelihood for -t 1 to 4 (razor_nll.h)
+ *   --fast_toys                   generate the toys directly in the template bins
+ *                                 (razor_toys.h, -a 0 or 1)
+ *   --seed                        random seed of the toys (-1 = default, 0 = random)
+ *   --profile                     base name of the timing report (profiler.h); by
+ *                                 default it is written next to the result file
+ *
+ * The results of the shards are merged (and analyzed) with
+ *
+ *   ./cls_analysis --merge merged.root Freq_CLs_grid_ts1_shard*of4_*.root
+ *
+ * which refuses shards run with different options (e.g. -n) or twice.
+ */
+
+#include <getopt.h>
+#include <cstdlib>
+#include <string>
+#include <iostream>
+
+#include "TROOT.h"
+
+#include "workspace_preparer.C"
+#include "config_reader.cxx"
+#include "StandardHypoTestInvDemo.C"
+
+
+// Options that have no short form in cls_analysis.py
+enum { kOptSFile = 256, kOptBFile, kOptDFile, kOptSigName, kOptBkgName, kOptDatName,
+       kOptCacheDir, kOptNoCache, kOptAdaptive, kOptTolerance, kOptMaxPoints,
+       kOptSequential, kOptBatchSize, kOptStopSigma, kOptShard, kOptNShards,
+       kOptCheckpoint, kOptMerge, kOptFastNLL, kOptFastToys, kOptSeed, kOptProfile };
+
+
+void print_usage(const char *prog){
+  std::cout << "Usage: " << prog << " [-c config] [-a calculatorType] "
+            << "[-t testStatType] [-p points] [-n ntoys] [-j threads] [-b]\n"
+            << "       [--sfile file] [--bfile file] [--dfile file] "
+            << "[--signame name] [--bkgname name] [--datname name]\n"
+            << "       [--cache_dir dir] [--no_cache] [--adaptive] [--tolerance t] [--max_points n]\n"
+            << "       [--sequential] [--batch_size n] [--stop_sigma z]\n"
+            << "       [--shard k --nshards n] [--checkpoint file] [--fast_nll] [--fast_toys]\n"
+            << "       [--seed n] [--profile name]\n"
+            << "   or: " << prog << " --merge merged.root shard_result.root ..." << std::endl;
+}
+
+
+int main(int argc, char **argv){
+
+  // Set defaults for optional values (as in cls_analysis.py)
+  std::string config_file_name = "config.cfg";
+  int calculatorType = 0;
+  int testStatType = 3;
+  bool useCLs = true;
+  int npoints = 4;
+  double poimin = 0;
+  double poimax = 1000;
+  int ntoys = 1000;
+  bool useNumberCounting = false;
+
+  std::string input_sig = "signal.root";
+  std::string input_bkg = "background.root";
+  std::string input_dat = "data.root";
+  std::string signame = "signal";
+  std::string bkgname = "background";
+  std::string datname = "data";
+  bool suppress = false;
+  std::string cache_dir = ".ws_cache";
+  std::string merge_output;
+
+  static struct option long_options[] = {
+    {"config_file_name",          required_argument, 0, 'c'},
+    {"calculatorType",            required_argument, 0, 'a'},
+    {"test_statistic_type",       required_argument, 0, 't'},
+    {"points",                    required_argument, 0, 'p'},
+    {"num_toys",                  required_argument, 0, 'n'},
+    {"threads",                   required_argument, 0, 'j'},
+    {"sfile",                     required_argument, 0, kOptSFile},
+    {"signal_histogram_file",     required_argument, 0, kOptSFile},
+    {"bfile",                     required_argument, 0, kOptBFile},
+    {"background_histogram_file", required_argument, 0, kOptBFile},
+    {"dfile",                     required_argument, 0, kOptDFile},
+    {"data_histogram_file",       required_argument, 0, kOptDFile},
+    {"signame",                   required_argument, 0, kOptSigName},
+    {"bkgname",                   required_argument, 0, kOptBkgName},
+    {"datname",                   required_argument, 0, kOptDatName},
+    {"cache_dir",                 required_argument, 0, kOptCacheDir},
+    {"no_cache",                  no_argument,       0, kOptNoCache},
+    {"adaptive",                  no_argument,       0, kOptAdaptive},
+    {"tolerance",                 required_argument, 0, kOptTolerance},
+    {"max_points",                required_argument, 0, kOptMaxPoints},
+    {"sequential",                no_argument,       0, kOptSequential},
+    {"batch_size",                required_argument, 0, kOptBatchSize},
+    {"stop_sigma",                required_argument, 0, kOptStopSigma},
+    {"fast_nll",                  no_argument,       0, kOptFastNLL},
+    {"fast_toys",                 no_argument,       0, kOptFastToys},
+    {"seed",                      required_argument, 0, kOptSeed},
+    {"profile",                   required_argument, 0, kOptProfile},
+    {"shard",                     required_argument, 0, kOptShard},
+    {"nshards",                   required_argument, 0, kOptNShards},
+    {"checkpoint",                required_argument, 0, kOptCheckpoint},
+    {"merge",                     required_argument, 0, kOptMerge},
+    {"help",                      no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "c:a:t:p:n:j:bh", long_options, 0)) != -1){
+    switch (opt){
+    case 'c': config_file_name = optarg; break;
+    case 'a': calculatorType = atoi(optarg); break;
+    case 't': testStatType = atoi(optarg); break;
+    case 'p': npoints = atoi(optarg); break;
+    case 'n': ntoys = atoi(optarg); break;
+    case 'j': nthreads = atoi(optarg); break;
+    case 'b': suppress = true; break;
+    case kOptSFile: input_sig = optarg; break;
+    case kOptBFile: input_bkg = optarg; break;
+    case kOptDFile: input_dat = optarg; break;
+    case kOptSigName: signame = optarg; break;
+    case kOptBkgName: bkgname = optarg; break;
+    case kOptDatName: datname = optarg; break;
+    case kOptCacheDir: cache_dir = optarg; break;
+    case kOptNoCache: cache_dir = ""; break;
+    case kOptAdaptive: adaptiveScan = true; break;
+    case kOptTolerance: adaptiveTolerance = atof(optarg); break;
+    case kOptMaxPoints: adaptiveMaxPoints = atoi(optarg); break;
+    case kOptSequential: sequentialToys = true; break;
+    case kOptBatchSize: toyBatchSize = atoi(optarg); break;
+    case kOptStopSigma: stopSignificance = atof(optarg); break;
+    case kOptFastNLL: fastNLL = true; break;
+    case kOptFastToys: fastToys = true; break;
+    case kOptSeed: randomSeed = atoi(optarg); break;
+    case kOptProfile: profileFileName = optarg; break;
+    case kOptShard: shardIndex = atoi(optarg); break;
+    case kOptNShards: nShards = atoi(optarg); break;
+    case kOptCheckpoint: checkpointFile = optarg; break;
+    case kOptMerge: merge_output = optarg; break;
+    case 'h': print_usage(argv[0]); return 0;
+    default: print_usage(argv[0]); return 1;
+    }
+  }
+
+  if (suppress) gROOT->SetBatch(kTRUE);
+
+  if (!merge_output.empty()){
+    std::string inputs;
+    for (int i = optind; i < argc; i++) inputs += std::string(argv[i]) + " ";
+    if (inputs.empty()){
+      print_usage(argv[0]);
+      return 1;
+    }
+    MergeResults(merge_output.c_str(), inputs.c_str(), "", useCLs);
+    return 0;
+  }
+
+  // The workspace file is no longer written, but its name is still used
+  // to build the name of the result file, as in cls_analysis.py.
+  std::string workspace = "_workspacefrom_" + input_sig + input_bkg + input_dat;
+  std::string cls_name = input_dat + "_cls.ps";
+  std::string bells_name = input_dat + "_bells.ps";
+
+  RooWorkspace *w = prepare_workspace(input_sig.c_str(), signame.c_str(),
+                                      input_bkg.c_str(), bkgname.c_str(),
+                                      input_dat.c_str(), datname.c_str(),
+                                      config_file_name.c_str(),
+                                      cache_dir.c_str());
+  if (!w){
+    std::cerr << "Could not prepare the workspace - Exit" << std::endl;
+    return 1;
+  }
+
+  HypoTestInverterResult *r =
+    StandardHypoTestInvOnWorkspace(w, workspace.c_str(), "SbModel", "BModel",
+                                   "data", calculatorType, testStatType,
+                                   useCLs, npoints, poimin, poimax, ntoys,
+                                   useNumberCounting, 0,
+                                   cls_name.c_str(), bells_name.c_str());
+
+  int status = (r) ? 0 : 1;
+  delete r;
+  delete w;
+  return status;
+}
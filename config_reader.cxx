@@ -14,6 +14,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
 #include "config_reader.h"
 #include <string>
 
@@ -133,11 +134,13 @@ void config_reader::factory_string(string str){
 }
 
 /*
- * Find all lines with factory declaration in them.  Cut out the part 
- * of the string between "make:" and the delimiter, and call the 
- * workspace factory method on it.
+ * Reads through the file and collects, line by line, the declarations
+ * that start with one of the given tags.  Each declaration is cut out
+ * from its tag to the delimiter (both included).  Naively assume a tag
+ * appears at most once per line.
  */
-void config_reader::factory_all(){
+vector<string> config_reader::find_declarations(const vector<string> &tags){
+  vector<string> declarations;
   string value;
   string line;
   ifstream config_file(file.c_str());
@@ -147,29 +150,58 @@ void config_reader::factory_all(){
     exit(1);
   }
   while (true){
-    int loc;
-    int end;
+    size_t loc = string::npos;
+    size_t end;
     getline(config_file, line);
     /* Nothing to do here, if line is nothing */
     if (config_file.eof())
       break;
     value = line;
-   /* Now, we have the line.  We must check and see if it has the
-    * expected char string.  Naively assume the string only appears once*/   
-    loc = value.find(factory_declaration);
-    if (loc != value.npos){
+    for (unsigned int i = 0; i < tags.size() && loc == string::npos; ++i)
+      loc = value.find(tags[i]);
+    if (loc != string::npos){
       end = value.find(delimiter);
-      if (end != value.npos){
-        // Pull out the value, including declaration / delimiter
-        value = value.substr(loc, end-loc+delimiter.length());
-        // Remove declaration and delimiter
-        value = strip_factory_declaration(value);
-        value = strip_delimiter(value);
-        // Put the variable into the workspace using the factory method.
-        factory_string(value); 
-      }
+      if (end != string::npos)
+        declarations.push_back(value.substr(loc, end-loc+delimiter.length()));
     }
   }
+  return declarations;
+}
+
+/*
+ * Find all lines with factory declaration in them.  Cut out the part 
+ * of the string between "make:" and the delimiter, and call the 
+ * workspace factory method on it.
+ */
+void config_reader::factory_all(){
+  vector<string> declarations =
+    find_declarations(vector<string>(1, factory_declaration));
+  for (unsigned int i = 0; i < declarations.size(); ++i){
+    // Remove declaration and delimiter
+    string value = strip_factory_declaration(declarations[i]);
+    value = strip_delimiter(value);
+    // Put the variable into the workspace using the factory method.
+    factory_string(value);
+  }
+}
+
+/*
+ * Collects every declaration that the config_reader acts on (factory
+ * and double declarations, with their tags, up to the delimiter), in the
+ * order in which they appear in the file, one per line.  Comments and
+ * spacing around the declarations are left out, so two config files
+ * that describe the same model give the same string.  This is used as
+ * part of the key of the workspace cache.
+ */
+string config_reader::resolved_declarations(){
+  vector<string> tags;
+  tags.push_back(factory_declaration);
+  tags.push_back(double_declaration);
+  vector<string> found = find_declarations(tags);
+  string declarations;
+  for (unsigned int i = 0; i < found.size(); ++i)
+    declarations += found[i] + "\n";
+  return declarations;
 }
 
 // Accessor
@@ -183,8 +215,8 @@ string config_reader::findstrip(string decl, string bound){
 }
 
 string config_reader::strip_bounds (string str, string bound1, string bound2){
-  val = str.substr(bound1.length(), str.length() - bound1.length() -
-                   bound2.length());
+  string val = str.substr(bound1.length(), str.length() - bound1.length() -
+                          bound2.length());
   return val;
 }
 
@@ -1,5 +1,10 @@
+#ifndef CONFIG_READER_H
+#define CONFIG_READER_H
+
 #include <iostream>
 #include <string>
+#include <vector>
+#include "RooWorkspace.h"
 using namespace std;
 class config_reader {
 
@@ -15,6 +20,11 @@ private:
   string background_hist_declaration;
   string double_declaration;
   RooWorkspace *ws;
+
+  // Returns every declaration of the file that starts with one of tags
+  // (the first one found on a line), up to and including the delimiter,
+  // in the order of the file.
+  vector<string> find_declarations(const vector<string> &tags);
   
 public:
   //constuctors
@@ -41,6 +51,10 @@ public:
   // Puts variables into the workspace, based on the config file.
   void factory_all();
 
+  // Returns all factory and double declarations of the file, one per
+  // line, without comments.
+  string resolved_declarations();
+
   // return the workspace
   RooWorkspace * getWorkspace();
 
@@ -48,11 +62,15 @@ public:
   string get_data_hist_name();
   string get_signal_hist_file_name();
   string get_signal_hist_name();
-  string get_data_hist_file_name();
-  string get_data_hist_name();
+  string get_background_hist_file_name();
+  string get_background_hist_name();
   
+  // Returns decl, ending at the occurence of bound.
+  string findstrip(string decl, string bound);
+
   string strip_bounds (string str, string bound1, string bound2);
   
   double find_double(string str);
 };
 
+#endif
@@ -0,0 +1,192 @@
+/*
+ * Process-wide timers and counters.  See profiler.h.
+ *
+ * Every update takes one lock; the finest grained users (one timer per
+ * toy and per fit) do much more work than that between updates.
+ */
+
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "TError.h"
+
+#include "profiler.h"
+
+
+namespace {
+
+   std::mutex gProfilerMutex;   // guards the Profiler
+
+   // names are plain identifiers, but escape them anyway
+   std::string JSONString(const std::string & s) {
+      std::string out = "\"";
+      for (unsigned int i = 0; i < s.size(); ++i) {
+         if (s[i] == '"' || s[i] == '\\') out += '\\';
+         out += s[i];
+      }
+      return out + "\"";
+   }
+
+} // end anonymous namespace
+
+
+
+RooStats::Profiler &
+RooStats::Profiler::Instance() {
+   static Profiler profiler;
+   return profiler;
+}
+
+
+
+double
+RooStats::Profiler::Now() {
+   return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+void
+RooStats::Profiler::AddTime(const char * name, double seconds) {
+   std::lock_guard<std::mutex> lock(gProfilerMutex);
+   Timer & t = fTimers[name];
+   if (t.calls == 0 || seconds < t.min) t.min = seconds;
+   if (t.calls == 0 || seconds > t.max) t.max = seconds;
+   t.calls++;
+   t.total += seconds;
+}
+
+
+
+void
+RooStats::Profiler::Count(const char * name, long n) {
+   std::lock_guard<std::mutex> lock(gProfilerMutex);
+   fCounters[name] += n;
+}
+
+
+
+void
+RooStats::Profiler::SetValue(const char * name, double value) {
+   std::lock_guard<std::mutex> lock(gProfilerMutex);
+   fValues[name] = value;
+}
+
+
+
+void
+RooStats::Profiler::AddPoint(double poi, double seconds, long toys) {
+   std::lock_guard<std::mutex> lock(gProfilerMutex);
+   for (unsigned int i = 0; i < fPoints.size(); ++i) {
+      if (fPoints[i].poi != poi) continue;
+      fPoints[i].calls++;
+      fPoints[i].toys += toys;
+      fPoints[i].seconds += seconds;
+      return;
+   }
+   Point p;
+   p.poi = poi;
+   p.calls = 1;
+   p.toys = toys;
+   p.seconds = seconds;
+   fPoints.push_back(p);
+}
+
+
+
+void
+RooStats::Profiler::Reset() {
+   std::lock_guard<std::mutex> lock(gProfilerMutex);
+   fTimers.clear();
+   fCounters.clear();
+   fValues.clear();
+   fPoints.clear();
+}
+
+
+
+bool
+RooStats::Profiler::Write(const char * base) const {
+   //
+   // write the timers, counters, values and points in base.json, and the
+   // same in base.csv, one row per entry:
+   //   kind,name,calls,total_s,mean_s,min_s,max_s
+   // (counters and values in the calls and total_s columns, points with
+   // their POI value as name and their toys as calls)
+   //
+
+   std::lock_guard<std::mutex> lock(gProfilerMutex);
+
+   std::string jsonName = std::string(base) + ".json";
+   std::ofstream json(jsonName.c_str());
+   if (!json.is_open()) {
+      Error("Profiler","Cannot write %s",jsonName.c_str());
+      return false;
+   }
+   json << std::setprecision(9);
+   json << "{\n  \"timers\": [";
+   for (std::map<std::string, Timer>::const_iterator it = fTimers.begin(); it != fTimers.end(); ++it) {
+      const Timer & t = it->second;
+      json << ((it == fTimers.begin()) ? "\n" : ",\n")
+           << "    {\"name\": " << JSONString(it->first) << ", \"calls\": " << t.calls
+           << ", \"total_s\": " << t.total << ", \"mean_s\": " << t.total / t.calls
+           << ", \"min_s\": " << t.min << ", \"max_s\": " << t.max << "}";
+   }
+   json << "\n  ],\n  \"counters\": {";
+   for (std::map<std::string, long>::const_iterator it = fCounters.begin(); it != fCounters.end(); ++it)
+      json << ((it == fCounters.begin()) ? "\n" : ",\n") << "    " << JSONString(it->first) << ": " << it->second;
+   json << "\n  },\n  \"values\": {";
+   for (std::map<std::string, double>::const_iterator it = fValues.begin(); it != fValues.end(); ++it)
+      json << ((it == fValues.begin()) ? "\n" : ",\n") << "    " << JSONString(it->first) << ": " << it->second;
+   json << "\n  },\n  \"points\": [";
+   for (unsigned int i = 0; i < fPoints.size(); ++i)
+      json << ((i == 0) ? "\n" : ",\n")
+           << "    {\"poi\": " << fPoints[i].poi << ", \"calls\": " << fPoints[i].calls
+           << ", \"toys\": " << fPoints[i].toys << ", \"seconds\": " << fPoints[i].seconds << "}";
+   json << "\n  ]\n}\n";
+   json.close();
+
+   std::string csvName = std::string(base) + ".csv";
+   std::ofstream csv(csvName.c_str());
+   if (!csv.is_open()) {
+      Error("Profiler","Cannot write %s",csvName.c_str());
+      return false;
+   }
+   csv << std::setprecision(9);
+   csv << "kind,name,calls,total_s,mean_s,min_s,max_s\n";
+   for (std::map<std::string, Timer>::const_iterator it = fTimers.begin(); it != fTimers.end(); ++it) {
+      const Timer & t = it->second;
+      csv << "timer," << it->first << "," << t.calls << "," << t.total << "," << t.total / t.calls
+          << "," << t.min << "," << t.max << "\n";
+   }
+   for (std::map<std::string, long>::const_iterator it = fCounters.begin(); it != fCounters.end(); ++it)
+      csv << "counter," << it->first << "," << it->second << ",,,,\n";
+   for (std::map<std::string, double>::const_iterator it = fValues.begin(); it != fValues.end(); ++it)
+      csv << "value," << it->first << ",," << it->second << ",,,\n";
+   for (unsigned int i = 0; i < fPoints.size(); ++i)
+      csv << "point," << fPoints[i].poi << "," << fPoints[i].toys << "," << fPoints[i].seconds
+          << "," << fPoints[i].seconds / fPoints[i].calls << ",,\n";
+   csv.close();
+
+   std::cout << "Timing report written to " << jsonName << " and " << csvName << std::endl;
+   return true;
+}
+
+
+
+void
+RooStats::Profiler::Print() const {
+   std::lock_guard<std::mutex> lock(gProfilerMutex);
+   std::cout << "Timing summary (seconds) : " << std::endl;
+   for (std::map<std::string, Timer>::const_iterator it = fTimers.begin(); it != fTimers.end(); ++it)
+      std::cout << " " << std::left << std::setw(28) << it->first << std::right
+                << " calls " << std::setw(8) << it->second.calls
+                << "  total " << std::setw(10) << it->second.total
+                << "  mean " << it->second.total / it->second.calls << std::endl;
+   for (std::map<std::string, long>::const_iterator it = fCounters.begin(); it != fCounters.end(); ++it)
+      std::cout << " " << std::left << std::setw(28) << it->first << std::right
+                << " count " << std::setw(8) << it->second << std::endl;
+}
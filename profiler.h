@@ -0,0 +1,84 @@
+/*
+ * Timers and counters of the phases of a limit computation: building the
+ * workspace and its snapshot fits (workspace_preparer.C), the initial fit,
+ * the scan and the rebuild (StandardHypoTestInvDemo.C), the generation
+ * and the test statistic of the toys (toy_engine.h) and the fits of the
+ * binned razor likelihood (razor_nll.h), plus the time and toys of each
+ * scan point.
+ *
+ * There is one Profiler per process, shared by all threads.  It is
+ * written as a JSON and a CSV file next to the result file at the end of
+ * the run (see HypoTestInvTool::AnalyzeResult).
+ *
+ * The implementation lives in profiler.cxx.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace RooStats {
+
+   class Profiler {
+
+   public:
+      static Profiler & Instance();
+      static double Now();                     // wall clock, in seconds
+
+      void AddTime(const char * name, double seconds);
+      void Count(const char * name, long n = 1);
+      void SetValue(const char * name, double value);
+
+      // time and toys run at the scan point poi (summed over calls)
+      void AddPoint(double poi, double seconds, long toys);
+
+      void Reset();
+
+      // write base.json and base.csv
+      bool Write(const char * base) const;
+      void Print() const;
+
+   private:
+      Profiler() {}
+
+      struct Timer {
+         Timer() : calls(0), total(0), min(0), max(0) {}
+         long calls;
+         double total;
+         double min;
+         double max;
+      };
+      struct Point {
+         double poi;
+         long calls;
+         long toys;
+         double seconds;
+      };
+
+      std::map<std::string, Timer> fTimers;
+      std::map<std::string, long> fCounters;
+      std::map<std::string, double> fValues;
+      std::vector<Point> fPoints;              // in the order of the scan
+   };
+
+   // adds the time between its construction and its destruction to a
+   // timer of the Profiler
+   class ProfileTimer {
+
+   public:
+      ProfileTimer(const char * name) : fName(name), fStart(Profiler::Now()) {}
+      ~ProfileTimer() { Profiler::Instance().AddTime(fName, Profiler::Now() - fStart); }
+
+   private:
+      const char * fName;
+      double fStart;
+   };
+
+} // end namespace RooStats
+
+#define PROFILE_SCOPE(name) RooStats::ProfileTimer profileScopeTimer(name)
+
+#endif
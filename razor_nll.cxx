@@ -0,0 +1,733 @@
+/*
+ * Binned likelihood test statistic for the razor model.  See razor_nll.h
+ * for the model and the NLL that is computed.
+ *
+ * The bin sums run over contiguous arrays of the occupied bins (the
+ * counts and the two template densities), without branches.  The value
+ * loop takes its logarithms from the inline VectorLog below instead of
+ * std::log, so that the compiler vectorizes it (gcc from -O3, see the
+ * Makefile; the additions stay in order, so the sum does not depend on
+ * it).  There is no explicit SIMD code.
+ *
+ * The gradient is analytic only in the two yields.  The derivatives of
+ * the yields and of the constraint terms with respect to the parameters
+ * are central finite differences: the yields are factory expressions of
+ * the config file, so their form is not known here.  They cost two
+ * evaluations of these small RooFit expressions per parameter,
+ * independent of the number of bins and events.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#include "RVersion.h"
+#include "TError.h"
+#include "TIterator.h"
+#include "TString.h"
+
+#include "Math/IFunction.h"
+#include "Math/Minimizer.h"
+#include "Math/MinimizerOptions.h"
+#include "Math/Factory.h"
+
+#include "RooAbsPdf.h"
+#include "RooAbsData.h"
+#include "RooArgSet.h"
+#include "RooArgList.h"
+#include "RooRealVar.h"
+#include "RooAbsBinning.h"
+#include "RooDataHist.h"
+#include "RooHistPdf.h"
+#include "RooExtendPdf.h"
+#include "RooAddPdf.h"
+#include "RooProdPdf.h"
+
+#include "RooStats/ModelConfig.h"
+
+#include "razor_nll.h"
+#include "profiler.h"
+
+
+namespace RooStats {
+
+   // Minimizer interface to RazorBinnedNLL::Eval
+   class RazorNLLFunction : public ROOT::Math::IMultiGradFunction {
+
+   public:
+      RazorNLLFunction(const RazorBinnedNLL * nll) : fNLL(nll) {}
+
+      ROOT::Math::IMultiGradFunction * Clone() const { return new RazorNLLFunction(fNLL); }
+      unsigned int NDim() const { return fNLL->NDim(); }
+      void Gradient(const double * x, double * grad) const { fNLL->Eval(x, grad); }
+      void FdF(const double * x, double & f, double * grad) const { f = fNLL->Eval(x, grad); }
+
+   private:
+      double DoEval(const double * x) const { return fNLL->Eval(x, 0); }
+      double DoDerivative(const double * x, unsigned int icoord) const {
+         std::vector<double> grad(NDim());
+         fNLL->Eval(x, &grad[0]);
+         return grad[icoord];
+      }
+
+      const RazorBinnedNLL * fNLL;
+   };
+
+} // end namespace RooStats
+
+
+namespace {
+
+   // floor of the expected density of an occupied bin, and of the
+   // constraint terms (to keep the logarithms finite)
+   const double kMinDensity = 1.E-300;
+
+   // Natural logarithm of a positive, finite, normal x, without branches
+   // or calls so that loops over it are vectorized (std::log is a call).
+   // x = 2^e (1 + f) with sqrt(2)/2 <= 1 + f < sqrt(2), and
+   // log(1 + f) = 2 atanh(s) with s = f / (2 + f), |s| < 0.172: the odd
+   // series of atanh up to s^23 is below the rounding error.  Within 1 ulp
+   // of std::log.
+   inline double VectorLog(double x) {
+      union { double d; unsigned long long u; } cx, cm, ce;
+      cx.d = x;
+      // shift the mantissa range to [sqrt(2)/2, sqrt(2))
+      unsigned long long u = cx.u + (0x3FF0000000000000ULL - 0x3FE6A09E667F3BCDULL);
+      cm.u = (u & 0x000FFFFFFFFFFFFFULL) + 0x3FE6A09E667F3BCDULL;
+      // exponent, converted to a double with the 2^52 trick
+      ce.u = (u >> 52) | 0x4330000000000000ULL;
+      double e = ce.d - (4503599627370496. + 1023.);
+
+      double f = cm.d - 1;
+      double s = f / (2 + f);
+      double z = s * s;
+      double p = 1. / 23;
+      p = 1. / 21 + z * p;
+      p = 1. / 19 + z * p;
+      p = 1. / 17 + z * p;
+      p = 1. / 15 + z * p;
+      p = 1. / 13 + z * p;
+      p = 1. / 11 + z * p;
+      p = 1. / 9 + z * p;
+      p = 1. / 7 + z * p;
+      p = 1. / 5 + z * p;
+      p = 1. / 3 + z * p;
+      // log(2) split in a high part exact in e * ln2hi and a low part
+      const double ln2hi = 6.93147180369123816490E-01;
+      const double ln2lo = 1.90821492927058770002E-10;
+      return e * ln2hi + (f - (s * (f - 2 * z * p) - e * ln2lo));
+   }
+
+   // first and second RooRealVar of a set
+   void TwoVariables(const RooArgSet & set, RooRealVar *& x, RooRealVar *& y) {
+      x = y = 0;
+      TIterator * it = set.createIterator();
+      while (TObject * o = it->Next()) {
+         RooRealVar * v = dynamic_cast<RooRealVar*>(o);
+         if (!v) continue;
+         if (!x) x = v;
+         else if (!y) y = v;
+      }
+      delete it;
+   }
+
+   bool SameBinning(const RooAbsBinning & a, const RooAbsBinning & b) {
+      if (a.numBins() != b.numBins()) return false;
+      for (int i = 0; i < a.numBins(); ++i) {
+         double scale = std::max(1., std::fabs(a.binLow(i)));
+         if (std::fabs(a.binLow(i) - b.binLow(i)) > 1.E-9 * scale) return false;
+      }
+      return std::fabs(a.highBound() - b.highBound()) <= 1.E-9 * std::max(1., std::fabs(a.highBound()));
+   }
+
+} // end anonymous namespace
+
+
+
+RooStats::RazorModel::RazorModel() : obs(0),
+                                     binningX(0),
+                                     binningY(0) {
+   component[0] = component[1] = 0;
+   hist[0] = hist[1] = 0;
+}
+
+
+
+RooStats::RazorModel::~RazorModel() {
+   delete binningX;
+   delete binningY;
+}
+
+
+
+bool
+RooStats::RazorModel::Read(RooAbsPdf & model, const RooArgSet & observables) {
+   //
+   // find the templates, yields and constraint terms of the model, and
+   // copy the template densities
+   //
+
+   obs = &observables;
+   RooProdPdf * prod = dynamic_cast<RooProdPdf*>(&model);
+   if (!prod) return false;
+
+   RooAddPdf * sum = 0;
+   const RooArgList & factors = prod->pdfList();
+   for (int i = 0; i < factors.getSize(); ++i) {
+      RooAddPdf * add = dynamic_cast<RooAddPdf*>(factors.at(i));
+      RooAbsPdf * pdf = dynamic_cast<RooAbsPdf*>(factors.at(i));
+      if (add) {
+         if (sum) return false;
+         sum = add;
+      }
+      else if (pdf) constraints.push_back(pdf);
+   }
+   if (!sum || sum->pdfList().getSize() != 2) return false;
+
+   for (int k = 0; k < 2; ++k) {
+      RooExtendPdf * ext = dynamic_cast<RooExtendPdf*>(sum->pdfList().at(k));
+      if (!ext) return false;
+      component[k] = ext;
+
+      RooHistPdf * hpdf = 0;
+      RooArgSet * comps = ext->getComponents();
+      TIterator * it = comps->createIterator();
+      while (TObject * o = it->Next())
+         if (!hpdf) hpdf = dynamic_cast<RooHistPdf*>(o);
+      delete it;
+      delete comps;
+      if (!hpdf) return false;
+
+      RooDataHist & dh = hpdf->dataHist();
+      hist[k] = &dh;
+      RooRealVar * x = 0;
+      RooRealVar * y = 0;
+      TwoVariables(*dh.get(), x, y);
+      if (!x || !y || dh.get()->getSize() != 2) return false;
+
+      if (k == 0) {
+         nameX = x->GetName();
+         nameY = y->GetName();
+         binningX = x->getBinning().clone();
+         binningY = y->getBinning().clone();
+      }
+      else if (nameX != x->GetName() || nameY != y->GetName() ||
+               !SameBinning(*binningX, x->getBinning()) || !SameBinning(*binningY, y->getBinning())) {
+         Warning("RazorModel","The two templates have different binnings");
+         return false;
+      }
+
+      if (k == 0) Overlaps(observables);
+
+      // density of a bin = content / (volume * total), where total is the
+      // content inside the range of the observables, as in RooHistPdf
+      std::vector<double> content(NBins(), 0.);
+      std::vector<double> volume(NBins(), 0.);
+      for (int i = 0; i < dh.numEntries(); ++i) {
+         const RooArgSet * coord = dh.get(i);
+         int bin = Bin(((RooAbsReal*) coord->find(nameX.c_str()))->getVal(),
+                       ((RooAbsReal*) coord->find(nameY.c_str()))->getVal());
+         if (bin < 0) continue;
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,24,0)
+         content[bin] = dh.weight(i);
+         volume[bin] = dh.binVolume(i);
+#else
+         content[bin] = dh.weight();
+         volume[bin] = dh.binVolume();
+#endif
+      }
+      double total = 0;
+      for (int bin = 0; bin < NBins(); ++bin) total += content[bin] * fraction[bin];
+      if (!(total > 0)) {
+         Warning("RazorModel","Template %s is empty in the range of the observables",hpdf->GetName());
+         return false;
+      }
+      density[k].assign(NBins(), 0.);
+      for (int bin = 0; bin < NBins(); ++bin)
+         if (volume[bin] > 0 && fraction[bin] > 0) density[k][bin] = content[bin] / (volume[bin] * total);
+   }
+   return true;
+}
+
+
+
+void
+RooStats::RazorModel::Overlaps(const RooArgSet & observables) {
+   //
+   // fraction of each template bin inside the range of the observables
+   // (1 for an observable that is not in the set)
+   //
+
+   const RooAbsBinning * binning[2] = { binningX, binningY };
+   const std::string * name[2] = { &nameX, &nameY };
+   std::vector<double> f[2];
+   for (int d = 0; d < 2; ++d) {
+      const RooRealVar * v = dynamic_cast<const RooRealVar*>(observables.find(name[d]->c_str()));
+      f[d].assign(binning[d]->numBins(), 1.);
+      if (!v) continue;
+      for (int i = 0; i < binning[d]->numBins(); ++i) {
+         double low = binning[d]->binLow(i);
+         double high = binning[d]->binHigh(i);
+         double inside = std::min(high, v->getMax()) - std::max(low, v->getMin());
+         f[d][i] = (high > low) ? std::max(0., std::min(1., inside / (high - low))) : 0.;
+      }
+   }
+   fraction.assign(NBins(), 0.);
+   for (int i = 0; i < binningX->numBins(); ++i)
+      for (int j = 0; j < binningY->numBins(); ++j)
+         fraction[i * binningY->numBins() + j] = f[0][i] * f[1][j];
+}
+
+
+
+int
+RooStats::RazorModel::Bin(double x, double y) const {
+   if (x < binningX->lowBound() || x > binningX->highBound()) return -1;
+   if (y < binningY->lowBound() || y > binningY->highBound()) return -1;
+   return binningX->binNumber(x) * binningY->numBins() + binningY->binNumber(y);
+}
+
+
+
+int
+RooStats::RazorModel::NBins() const {
+   return (binningX && binningY) ? binningX->numBins() * binningY->numBins() : 0;
+}
+
+
+
+void
+RooStats::RazorModel::Yields(double & nu0, double & nu1) const {
+   nu0 = component[0]->expectedEvents(*obs);
+   nu1 = component[1]->expectedEvents(*obs);
+}
+
+
+
+double
+RooStats::RazorModel::ConstraintNLL() const {
+   double nll = 0;
+   for (unsigned int i = 0; i < constraints.size(); ++i)
+      nll -= std::log(std::max(constraints[i]->getVal(), kMinDensity));
+   return nll;
+}
+
+
+
+void
+RooStats::RazorFitCache::Add(const Entry & entry) {
+   //
+   // add the entry of a POI value (an existing entry is kept)
+   //
+
+   if (Find(entry.poi)) return;
+   fEntries.push_back(entry);
+   fLast = fEntries.size() - 1;
+}
+
+
+
+const RooStats::RazorFitCache::Entry *
+RooStats::RazorFitCache::Find(double poi) const {
+   for (unsigned int i = 0; i < fEntries.size(); ++i)
+      if (fEntries[i].poi == poi) return &fEntries[i];
+   return 0;
+}
+
+
+
+const RooStats::RazorFitCache::Entry *
+RooStats::RazorFitCache::Last() const {
+   return (fLast >= 0) ? &fEntries[fLast] : 0;
+}
+
+
+
+RooStats::RazorBinnedNLL::RazorBinnedNLL(ModelConfig & sbModel, ModelConfig & bModel,
+                                         int testStatType) : fValid(false),
+                                                             fType(testStatType),
+                                                             fAltPOI(0),
+                                                             fStrategy(ROOT::Math::MinimizerOptions::DefaultStrategy()),
+                                                             fPrintLevel(0),
+                                                             fMinimizerType("Minuit2"),
+                                                             fMinimizer(0),
+                                                             fFunction(0),
+                                                             fCache(0),
+                                                             fObserved(0) {
+
+   if (fType < 1 || fType > 4) {
+      Error("RazorBinnedNLL","Test statistic type %d is not a profile likelihood (1 to 4)",fType);
+      return;
+   }
+   const RooArgSet * poi = sbModel.GetParametersOfInterest();
+   if (!sbModel.GetPdf() || !sbModel.GetObservables() || !poi || poi->getSize() != 1) {
+      Error("RazorBinnedNLL","The model needs a pdf, observables and one parameter of interest");
+      return;
+   }
+   if (!fModel.Read(*sbModel.GetPdf(), *sbModel.GetObservables()) ||
+       !ReadParameters(*sbModel.GetPdf(), *poi)) {
+      Warning("RazorBinnedNLL","Model %s is not a sum of two extended RooHistPdf templates times constraint terms",
+              sbModel.GetPdf()->GetName());
+      return;
+   }
+
+   // POI value of the alternate hypothesis (Tevatron test statistic)
+   if (bModel.GetSnapshot()) {
+      RooRealVar * altPOI = dynamic_cast<RooRealVar*>(bModel.GetSnapshot()->find(fVars[0]->GetName()));
+      if (altPOI) fAltPOI = altPOI->getVal();
+   }
+
+   fFunction = new RazorNLLFunction(this);
+   SetMinimizer("");
+   fValid = (fMinimizer != 0);
+}
+
+
+
+RooStats::RazorBinnedNLL::~RazorBinnedNLL() {
+   delete fMinimizer;
+   delete fFunction;
+}
+
+
+
+void
+RooStats::RazorBinnedNLL::SetMinimizer(const char * minimizerType) {
+   //
+   // minimizer used for the fits (Minuit2 by default).  It is created here,
+   // in the calling thread, since it may load a plugin library
+   //
+
+   if (minimizerType && std::strlen(minimizerType) > 0) fMinimizerType = minimizerType;
+   delete fMinimizer;
+   fMinimizer = ROOT::Math::Factory::CreateMinimizer(fMinimizerType, "Migrad");
+   if (!fMinimizer) {
+      Error("RazorBinnedNLL","Cannot create the minimizer %s",fMinimizerType.c_str());
+      fValid = false;
+   }
+}
+
+
+
+void
+RooStats::RazorBinnedNLL::SetColdStart() {
+   GetParameters(fColdStart);
+}
+
+
+
+const TString
+RooStats::RazorBinnedNLL::GetVarName() const {
+   return TString::Format("Razor binned profile likelihood (type %d)",fType);
+}
+
+
+
+bool
+RooStats::RazorBinnedNLL::ReadParameters(RooAbsPdf & model, const RooArgSet & poi) {
+   //
+   // floating parameters of the model, POI first
+   //
+
+   RooArgSet * params = model.getParameters(*fModel.obs);
+   RooRealVar * poiVar = dynamic_cast<RooRealVar*>(params->find(poi.first()->GetName()));
+   if (poiVar) {
+      fVars.push_back(poiVar);
+      TIterator * it = params->createIterator();
+      while (TObject * o = it->Next()) {
+         RooRealVar * v = dynamic_cast<RooRealVar*>(o);
+         if (v && v != poiVar && !v->isConstant()) fVars.push_back(v);
+      }
+      delete it;
+   }
+   delete params;
+   return poiVar != 0;
+}
+
+
+
+bool
+RooStats::RazorBinnedNLL::Fill(RooAbsData & data) {
+   //
+   // count the (weighted) events of data in the template bins, and keep
+   // the occupied bins
+   //
+
+   fCounts.clear();
+   fBinDensity[0].clear();
+   fBinDensity[1].clear();
+   if (data.numEntries() == 0) return true;
+
+   // the row of a data set is the same object for all entries
+   const RooArgSet * row = data.get(0);
+   RooAbsReal * x = dynamic_cast<RooAbsReal*>(row->find(fModel.nameX.c_str()));
+   RooAbsReal * y = dynamic_cast<RooAbsReal*>(row->find(fModel.nameY.c_str()));
+   if (!x || !y) {
+      Error("RazorBinnedNLL","Data set %s has no observables %s and %s",data.GetName(),
+            fModel.nameX.c_str(),fModel.nameY.c_str());
+      return false;
+   }
+
+   std::vector<double> counts(fModel.NBins(), 0.);
+   double outside = 0;
+   for (int i = 0; i < data.numEntries(); ++i) {
+      data.get(i);
+      int bin = fModel.Bin(x->getVal(), y->getVal());
+      if (bin >= 0) counts[bin] += data.weight();
+      else outside += data.weight();
+   }
+   if (outside > 0)
+      Warning("RazorBinnedNLL","Data set %s has %g (weighted) events outside of the template binning, they are ignored",
+              data.GetName(),outside);
+   for (unsigned int bin = 0; bin < counts.size(); ++bin) {
+      if (counts[bin] <= 0) continue;
+      fCounts.push_back(counts[bin]);
+      fBinDensity[0].push_back(fModel.density[0][bin]);
+      fBinDensity[1].push_back(fModel.density[1][bin]);
+   }
+   return true;
+}
+
+
+
+void
+RooStats::RazorBinnedNLL::SetParameters(const std::vector<double> & values) {
+   for (unsigned int j = 0; j < fVars.size(); ++j) fVars[j]->setVal(values[j]);
+}
+
+
+
+void
+RooStats::RazorBinnedNLL::GetParameters(std::vector<double> & values) const {
+   values.resize(fVars.size());
+   for (unsigned int j = 0; j < fVars.size(); ++j) values[j] = fVars[j]->getVal();
+}
+
+
+
+double
+RooStats::RazorBinnedNLL::Eval(const double * x, double * grad) const {
+
+   for (unsigned int j = 0; j < fVars.size(); ++j) fVars[j]->setVal(x[j]);
+
+   double nu0 = 0;
+   double nu1 = 0;
+   fModel.Yields(nu0, nu1);
+
+   const int nbins = fCounts.size();
+   const double * n = (nbins > 0) ? &fCounts[0] : 0;
+   const double * s0 = (nbins > 0) ? &fBinDensity[0][0] : 0;
+   const double * s1 = (nbins > 0) ? &fBinDensity[1][0] : 0;
+
+   // no per-bin branch (the floor is added, and VectorLog has no special
+   // cases), so that the compiler vectorizes the loop
+   double logSum = 0;
+   for (int i = 0; i < nbins; ++i)
+      logSum += n[i] * VectorLog(nu0 * s0[i] + nu1 * s1[i] + kMinDensity);
+
+   double nll = nu0 + nu1 - logSum + fModel.ConstraintNLL();
+   if (!grad) return nll;
+
+   // derivatives with respect to the two yields
+   double dnu0 = 1;
+   double dnu1 = 1;
+   for (int i = 0; i < nbins; ++i) {
+      double r = n[i] / std::max(nu0 * s0[i] + nu1 * s1[i], kMinDensity);
+      dnu0 -= r * s0[i];
+      dnu1 -= r * s1[i];
+   }
+
+   // chain rule, with the derivatives of the yields and of the constraint
+   // terms by finite differences (kept inside the parameter range)
+   for (unsigned int j = 0; j < fVars.size(); ++j) {
+      RooRealVar * v = fVars[j];
+      double h = 1.E-5 * std::max(1., std::fabs(x[j]));
+      double up = std::min(h, v->getMax() - x[j]);
+      double down = std::min(h, x[j] - v->getMin());
+      if (up + down <= 0) {
+         grad[j] = 0;
+         continue;
+      }
+      double nuUp0, nuUp1, nuDown0, nuDown1;
+      v->setVal(x[j] + up);
+      fModel.Yields(nuUp0, nuUp1);
+      double cUp = fModel.ConstraintNLL();
+      v->setVal(x[j] - down);
+      fModel.Yields(nuDown0, nuDown1);
+      double cDown = fModel.ConstraintNLL();
+      v->setVal(x[j]);
+      grad[j] = (dnu0 * (nuUp0 - nuDown0) + dnu1 * (nuUp1 - nuDown1) + cUp - cDown) / (up + down);
+   }
+   return nll;
+}
+
+
+
+double
+RooStats::RazorBinnedNLL::Minimize(bool fixPOI, double poiValue, const std::vector<double> * steps,
+                                   int strategy, double & poihat, int & status) {
+   //
+   // minimize the NLL of the current data set, starting from the current
+   // parameter values, with the POI floating or fixed at poiValue.  The
+   // step sizes are steps, or 0.1 * max(1, |value|) where it has none, so
+   // they depend only on the starting point.  The parameters are left at
+   // the minimum, and their errors in fErrors
+   //
+
+   fMinimizer->Clear();
+   fMinimizer->SetFunction(*fFunction);
+   fMinimizer->SetErrorDef(0.5);
+   fMinimizer->SetStrategy(strategy);
+   // same tolerance as ProfileLikelihoodTestStat, which the test statistic
+   // replaces: Migrad stops at an EDM of order 1E-3 * tolerance, below the
+   // precision needed for the NLL differences of the test statistic
+   fMinimizer->SetTolerance(std::max(1., ROOT::Math::MinimizerOptions::DefaultTolerance()));
+   fMinimizer->SetPrintLevel(std::max(fPrintLevel - 1, 0));
+
+   for (unsigned int j = 0; j < fVars.size(); ++j) {
+      RooRealVar * v = fVars[j];
+      std::string name = v->GetName();
+      if (j == 0 && fixPOI) {
+         fMinimizer->SetFixedVariable(j, name, poiValue);
+         continue;
+      }
+      // the errors of the RooRealVars depend on the fits run before on
+      // them (by this or other objects): the steps never come from there
+      double step = 0.1 * std::max(1., std::fabs(v->getVal()));
+      if (steps && j < steps->size() && (*steps)[j] > 0) step = (*steps)[j];
+      if (v->hasMin() && v->hasMax()) {
+         step = std::min(step, 0.1 * (v->getMax() - v->getMin()));
+         fMinimizer->SetLimitedVariable(j, name, v->getVal(), step, v->getMin(), v->getMax());
+      }
+      else if (v->hasMin())
+         fMinimizer->SetLowerLimitedVariable(j, name, v->getVal(), step, v->getMin());
+      else if (v->hasMax())
+         fMinimizer->SetUpperLimitedVariable(j, name, v->getVal(), step, v->getMax());
+      else
+         fMinimizer->SetVariable(j, name, v->getVal(), step);
+   }
+
+   bool ok = false;
+   {
+      PROFILE_SCOPE("razor_fit");
+      ok = fMinimizer->Minimize();
+   }
+   status = (ok) ? 0 : std::max(fMinimizer->Status(), 1);
+   Profiler::Instance().Count("razor_fit_nll_calls", fMinimizer->NCalls());
+   if (status != 0) Profiler::Instance().Count("razor_fit_failures");
+
+   const double * x = fMinimizer->X();
+   const double * errors = fMinimizer->Errors();
+   fErrors.assign(fVars.size(), 0.);
+   for (unsigned int j = 0; j < fVars.size(); ++j) {
+      fVars[j]->setVal(x[j]);
+      if (errors) fErrors[j] = errors[j];
+   }
+   poihat = x[0];
+   return fMinimizer->MinValue();
+}
+
+
+
+double
+RooStats::RazorBinnedNLL::Fit(bool fixPOI, double poiValue, const std::vector<double> & coldStart,
+                              const std::vector<double> * steps, double & poihat, int & status) {
+   //
+   // warm started fit: from the current parameter values first and, if it
+   // fails, as for the initial fit of RunInverter, from coldStart with
+   // strategy 0 and then 1
+   //
+
+   double nll = Minimize(fixPOI, poiValue, steps, fStrategy, poihat, status);
+   for (int strategy = 0; strategy <= 1 && status != 0; ++strategy) {
+      if (fPrintLevel > 0)
+         Info("RazorBinnedNLL","Warm started fit failed (status %d) - retry with strategy %d",status,strategy);
+      Profiler::Instance().Count("razor_fit_retries");
+      SetParameters(coldStart);
+      nll = Minimize(fixPOI, poiValue, 0, strategy, poihat, status);
+   }
+   return nll;
+}
+
+
+
+Double_t
+RooStats::RazorBinnedNLL::Evaluate(RooAbsData & data, RooArgSet & nullPOI) {
+   //
+   // value of the test statistic on data for the POI value in nullPOI.  The
+   // fits start from the current parameter values, which are restored at
+   // the end.  The observed data are fitted once per POI value, starting
+   // from the fit of the previous POI value, and the result is kept in the
+   // cache: their value depends only on the sequence of POI values, not on
+   // the batches run at each of them
+   //
+
+   if (!fValid) return 0;
+
+   RooRealVar * nullVar = dynamic_cast<RooRealVar*>(nullPOI.find(fVars[0]->GetName()));
+   double mu = (nullVar) ? nullVar->getVal() : fVars[0]->getVal();
+
+   bool observed = (fCache && &data == fObserved);
+   const RazorFitCache::Entry * cached = (fCache) ? fCache->Find(mu) : 0;
+   if (observed && cached) return cached->value;
+
+   std::vector<double> start;
+   GetParameters(start);
+   const std::vector<double> & coldStart = (fColdStart.size() == start.size()) ? fColdStart : start;
+
+   if (!Fill(data)) return 0;
+
+   const std::vector<double> * steps = (cached && cached->converged) ? &cached->errors : 0;
+   const RazorFitCache::Entry * previous = (observed) ? fCache->Last() : 0;
+   if (previous) SetParameters(previous->values);
+
+   RazorFitCache::Entry entry;
+   entry.poi = mu;
+   double poihat = 0;
+   double unused = 0;
+   int status0 = 0;
+   int status1 = 0;
+   std::vector<double> errors;
+   if (fType == 1) {
+      // ratio of the profiled likelihoods of the null and alternate POI;
+      // the alternate fit starts from the null one
+      double nllNull = Fit(true, mu, coldStart, steps, unused, status0);
+      GetParameters(entry.values);
+      errors = fErrors;
+      double nllAlt = Fit(true, fAltPOI, coldStart, &errors, unused, status1);
+      entry.value = nllNull - nllAlt;
+      entry.errors = errors;
+   }
+   else {
+      double nllMin = Fit(false, 0, coldStart, steps, poihat, status0);
+      errors = fErrors;
+      if (fType == 3 && poihat > mu && !observed) {
+         // one sided: the conditional fit is not needed
+         entry.value = 0;
+      }
+      else {
+         // the conditional fit starts from the unconditional one
+         double nllCond = Fit(true, mu, coldStart, &errors, unused, status1);
+         entry.value = nllCond - nllMin;
+         if (poihat > mu) {
+            if (fType == 3) entry.value = 0;
+            else if (fType == 4) entry.value = -entry.value;
+         }
+         GetParameters(entry.values);
+         entry.errors = fErrors;
+         entry.errors[0] = errors[0];      // the POI is fixed in the conditional fit
+      }
+   }
+   SetParameters(start);
+
+   entry.converged = (status0 == 0 && status1 == 0);
+   if (observed) fCache->Add(entry);
+
+   if (!entry.converged)
+      Warning("RazorBinnedNLL","Fit failed (status %d , %d) for %s = %g",status0,status1,fVars[0]->GetName(),mu);
+   if (fPrintLevel > 0)
+      std::cout << "RazorBinnedNLL : " << fVars[0]->GetName() << " = " << mu
+                << " value = " << entry.value << std::endl;
+   return entry.value;
+}
@@ -0,0 +1,207 @@
+/*
+ * Dedicated binned likelihood for the razor model built by
+ * workspace_preparer.C:
+ *
+ *   model = (S * sig(MR,RSQ) + B * bkg(MR,RSQ)) * constraint terms
+ *
+ * where sig and bkg are RooHistPdf templates wrapped in RooExtendPdfs and
+ * added in a RooAddPdf.  The template densities are copied once into
+ * arrays, and for each data set the events are counted in the template
+ * bins, so that the NLL is a sum over the occupied bins instead of a walk
+ * of the RooFit expression graph for every event:
+ *
+ *   NLL = S + B - sum_bins n_i log(S s_i + B b_i) - sum_k log(c_k)
+ *
+ * The derivatives of the NLL with respect to S and B are analytic.  The
+ * derivatives of S, B and the c_k with respect to the parameters are
+ * finite differences, since S, B and the c_k are still computed by the
+ * workspace objects (built from the config file).
+ *
+ * The fits are warm started: the second fit of a data set starts from
+ * the first one, and with a RazorFitCache the fit of the observed data
+ * at a scan point starts from the one of the previous point, and the fits
+ * of the toys take their step sizes from the fit of the observed data at
+ * their point.  A warm start that fails is redone from a cold start: the
+ * parameter values at the call (the generation point of the toy in the
+ * toy engine), or the point set by SetColdStart.
+ *
+ * RazorBinnedNLL is a drop-in replacement for the profile likelihood
+ * test statistics (types 1 to 4 of StandardHypoTestInvDemo.C).  It is
+ * built by BuildTestStatistic (toy_engine.h) when fastNLL is set.  The
+ * reading of the model (RazorModel) is shared with the fast toy generator
+ * of razor_toys.h.
+ */
+
+#ifndef RAZOR_NLL_H
+#define RAZOR_NLL_H
+
+#include <string>
+#include <vector>
+
+#include "RooStats/TestStatistic.h"
+
+class RooAbsPdf;
+class RooAbsData;
+class RooRealVar;
+class RooArgSet;
+class RooAbsBinning;
+class RooDataHist;
+
+namespace ROOT {
+   namespace Math {
+      class Minimizer;
+   }
+}
+
+namespace RooStats {
+
+   class ModelConfig;
+   class RazorNLLFunction;
+
+   // The parts of the razor model shared by RazorBinnedNLL and the fast
+   // toy generator (razor_toys.h): the two extended templates, their
+   // common binning and the constraint terms.  The pointers refer to the
+   // objects of the model, which must outlive the RazorModel.
+   struct RazorModel {
+      RazorModel();
+      ~RazorModel();
+
+      // false if the model does not have the shape above
+      bool Read(RooAbsPdf & model, const RooArgSet & observables);
+
+      int Bin(double x, double y) const;          // template bin, -1 if outside
+      int NBins() const;                          // number of template bins
+
+      // yields and constraint terms at the current parameter values
+      void Yields(double & nu0, double & nu1) const;
+      double ConstraintNLL() const;
+
+      const RooArgSet * obs;
+      RooAbsPdf * component[2];                // the two extended templates
+      RooDataHist * hist[2];                   // their histograms
+      std::vector<RooAbsPdf*> constraints;
+
+      RooAbsBinning * binningX;                // template binning
+      RooAbsBinning * binningY;
+      std::string nameX;
+      std::string nameY;
+      std::vector<double> density[2];          // template densities, per bin
+      std::vector<double> fraction;            // part of each bin inside the range of the observables
+
+   private:
+      void Overlaps(const RooArgSet & observables);
+
+      RazorModel(const RazorModel &);
+      RazorModel & operator=(const RazorModel &);
+   };
+
+   // Results of the fits of the observed data, by POI value.  The fits of
+   // the toys at a POI value take their step sizes from its entry, and the
+   // fit of the observed data at a new POI value starts from the entry
+   // added last (the previous point of the scan).  Only the first
+   // evaluation of the observed data at a POI value fills the cache; the
+   // later ones return its value.  The toys of a point therefore depend on
+   // the sequence of scan points, but not on the batches or shards they
+   // are run in, nor on how they are split between threads.
+   class RazorFitCache {
+
+   public:
+      struct Entry {
+         double poi;
+         double value;                         // test statistic of the observed data
+         bool converged;                       // false if one of the fits failed
+         std::vector<double> values;           // fitted parameters, POI first
+         std::vector<double> errors;           // square roots of the covariance diagonal
+      };
+
+      RazorFitCache() : fLast(-1) {}
+
+      void Add(const Entry & entry);           // an existing entry is kept
+      const Entry * Find(double poi) const;    // entry of this POI value, 0 if none
+      const Entry * Last() const;              // entry added last, 0 if none
+      void Clear() { fEntries.clear(); fLast = -1; }
+
+   private:
+      std::vector<Entry> fEntries;             // in the order they were added
+      int fLast;
+   };
+
+   class RazorBinnedNLL : public TestStatistic {
+
+   public:
+      // testStatType as in StandardHypoTestInvDemo.C: 1 (Tevatron), 2 (two
+      // sided), 3 (one sided) or 4 (signed) profile likelihood.  The
+      // alternate POI value of type 1 is taken from the snapshot of bModel.
+      RazorBinnedNLL(ModelConfig & sbModel, ModelConfig & bModel, int testStatType);
+      virtual ~RazorBinnedNLL();
+
+      // false if the model does not have the shape above
+      bool IsValid() const { return fValid; }
+
+      // minimizer of the fits, Minuit2 if minimizerType is empty.  TMinuit
+      // ("Minuit") has global state: such a test statistic must not be
+      // evaluated in several threads at once
+      void SetMinimizer(const char * minimizerType);
+      bool IsThreadSafe() const { return fMinimizerType != "Minuit" && fMinimizerType != "TMinuit"; }
+      void SetStrategy(int strategy) { fStrategy = strategy; }
+      void SetPrintLevel(int printLevel) { fPrintLevel = printLevel; }
+
+      // Warm start the fits from cache (not owned), and fill it with the
+      // fits of the data set observed.  The cache may be shared by the
+      // test statistics of several threads, as long as only one of them
+      // is given the observed data.
+      void SetFitCache(RazorFitCache * cache, const RooAbsData * observed) {
+         fCache = cache;
+         fObserved = observed;
+      }
+
+      // Redo the failed fits from the current parameter values (e.g. the
+      // ones of the initial fit), instead of from the values at the call
+      // of Evaluate.
+      void SetColdStart();
+
+      virtual Double_t Evaluate(RooAbsData & data, RooArgSet & nullPOI);
+      virtual const TString GetVarName() const;
+
+      // NLL of the current data set (up to a constant) at the parameter
+      // point x, and its gradient if grad is not 0.  The parameters are the
+      // POI followed by the floating nuisance parameters.
+      double Eval(const double * x, double * grad) const;
+      unsigned int NDim() const { return fVars.size(); }
+
+   private:
+      bool ReadParameters(RooAbsPdf & model, const RooArgSet & poi);
+      bool Fill(RooAbsData & data);
+      double Minimize(bool fixPOI, double poiValue, const std::vector<double> * steps,
+                      int strategy, double & poihat, int & status);
+      double Fit(bool fixPOI, double poiValue, const std::vector<double> & coldStart,
+                 const std::vector<double> * steps, double & poihat, int & status);
+      void SetParameters(const std::vector<double> & values);
+      void GetParameters(std::vector<double> & values) const;
+
+      bool fValid;
+      int fType;
+      double fAltPOI;                          // POI value of the alternate (type 1)
+      int fStrategy;
+      int fPrintLevel;
+      std::string fMinimizerType;
+
+      RazorModel fModel;
+      std::vector<RooRealVar*> fVars;          // POI, then floating nuisance parameters
+
+      // occupied bins of the current data set
+      std::vector<double> fCounts;
+      std::vector<double> fBinDensity[2];
+
+      ROOT::Math::Minimizer * fMinimizer;
+      RazorNLLFunction * fFunction;
+      std::vector<double> fErrors;             // parameter errors of the last fit
+      std::vector<double> fColdStart;          // starting point of the retries, empty if not set
+
+      RazorFitCache * fCache;
+      const RooAbsData * fObserved;
+   };
+
+} // end namespace RooStats
+
+#endif
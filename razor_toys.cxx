@@ -0,0 +1,389 @@
+/*
+ * Fast toy generator for the razor model.  See razor_toys.h.
+ *
+ * Per toy there is no allocation and no RooFit generation: four draws
+ * of the global observables (no RooFit evaluation either), two
+ * evaluations of the yields, and one Poisson draw per template bin.  Small means are
+ * drawn by inversion, large ones with the transformed rejection method
+ * of Hormann (PTRS), whose cost does not grow with the mean.
+ */
+
+#include <cmath>
+#include <algorithm>
+
+#include "RVersion.h"
+#include "TError.h"
+#include "TIterator.h"
+#include "TMath.h"
+
+#include "RooAbsPdf.h"
+#include "RooArgSet.h"
+#include "RooRealVar.h"
+#include "RooDataHist.h"
+
+#include "RooStats/ModelConfig.h"
+
+#include "razor_toys.h"
+
+
+namespace {
+
+   // cells of the table of a global observable that is not Gaussian
+   const int kCells = 64;
+
+   // 8 point Gauss-Legendre rule on [-1,1]
+   const int kNodes = 8;
+   const double kNode[kNodes] = { -0.9602898564975363, -0.7966664774136267, -0.5255324099163290, -0.1834346424956498,
+                                   0.1834346424956498,  0.5255324099163290,  0.7966664774136267,  0.9602898564975363 };
+   const double kWeight[kNodes] = { 0.1012285362903763, 0.2223810344533745, 0.3137066458778873, 0.3626837833783620,
+                                    0.3626837833783620, 0.3137066458778873, 0.2223810344533745, 0.1012285362903763 };
+
+   // coefficients (of t^0 ... t^7) of the polynomial through the values
+   // at the nodes t_k = (1 + kNode[k]) / 2 of [0,1]
+   void Interpolate(const double * values, double * coef) {
+      double t[kNodes];
+      double d[kNodes];
+      for (int k = 0; k < kNodes; ++k) {
+         t[k] = 0.5 * (1 + kNode[k]);
+         d[k] = values[k];
+      }
+      // divided differences, then the Newton form expanded from its last term
+      for (int j = 1; j < kNodes; ++j)
+         for (int k = kNodes - 1; k >= j; --k)
+            d[k] = (d[k] - d[k - 1]) / (t[k] - t[k - j]);
+      for (int k = 0; k < kNodes; ++k) coef[k] = 0;
+      coef[0] = d[kNodes - 1];
+      for (int j = kNodes - 2; j >= 0; --j) {
+         for (int k = kNodes - 1; k > 0; --k) coef[k] = coef[k - 1] - t[j] * coef[k];
+         coef[0] = d[j] - t[j] * coef[0];
+      }
+   }
+
+   // true if log(pdf) is a parabola in g (a Gaussian) over the range of
+   // g: fitted on three points, and checked on a fourth one
+   bool IsGaussian(RooRealVar & g, const RooAbsPdf & pdf, double & mean, double & sigma) {
+      double low = g.getMin();
+      double width = g.getMax() - low;
+      double x[4];
+      double y[4];
+      for (int k = 0; k < 4; ++k) {
+         x[k] = low + (k + 1) * width / 5;
+         g.setVal(x[k]);
+         double v = pdf.getVal();
+         if (!(v > 0)) return false;
+         y[k] = std::log(v);
+      }
+      double slope01 = (y[1] - y[0]) / (x[1] - x[0]);
+      double slope12 = (y[2] - y[1]) / (x[2] - x[1]);
+      double c = (slope12 - slope01) / (x[2] - x[0]);
+      double b = slope01 - c * (x[0] + x[1]);
+      double a = y[0] - b * x[0] - c * x[0] * x[0];
+      // a curvature at the rounding level is an exponential (or flat) pdf
+      if (!(c * width * width < -1.E-6)) return false;
+      if (std::fabs(a + b * x[3] + c * x[3] * x[3] - y[3]) > 1.E-8 * (1 + std::fabs(y[3]))) return false;
+      mean = -b / (2 * c);
+      sigma = std::sqrt(-0.5 / c);
+      return true;
+   }
+
+   // mass of the normal (mean, sigma) in [low, high]; in the upper tail it
+   // is taken from the complements, for precision
+   double NormalMass(double mean, double sigma, double low, double high) {
+      double za = (low - mean) / sigma;
+      double zb = (high - mean) / sigma;
+      if (za > 0) return TMath::Freq(-za) - TMath::Freq(-zb);
+      return TMath::Freq(zb) - TMath::Freq(za);
+   }
+
+   // inverse CDF of the normal (mean, sigma) truncated to [low, high]
+   double TruncatedNormal(double mean, double sigma, double low, double high, double u) {
+      double za = (low - mean) / sigma;
+      double zb = (high - mean) / sigma;
+      double x = 0;
+      if (za > 0) {
+         double qa = TMath::Freq(-za);
+         double qb = TMath::Freq(-zb);
+         x = mean - sigma * TMath::NormQuantile(qa - u * (qa - qb));
+      }
+      else {
+         double pa = TMath::Freq(za);
+         double pb = TMath::Freq(zb);
+         x = mean + sigma * TMath::NormQuantile(pa + u * (pb - pa));
+      }
+      return std::max(low, std::min(high, x));
+   }
+
+   // Philox4x32-10 counter-based generator (Salmon et al., SC11).  The
+   // key is the toy seed and the counter starts at 0, so every toy has
+   // an independent stream.
+   class Philox4x32 {
+
+   public:
+      Philox4x32(unsigned int seed) : fUsed(4) {
+         fKey[0] = seed;
+         fKey[1] = 0x52415A52;          // "RAZR"
+         fCounter[0] = fCounter[1] = fCounter[2] = fCounter[3] = 0;
+      }
+
+      unsigned int Next() {
+         if (fUsed == 4) NextBlock();
+         return fOut[fUsed++];
+      }
+
+      // uniform in (0,1), with 53 random bits
+      double Uniform() {
+         unsigned long long a = Next() >> 5;
+         unsigned long long b = Next() >> 6;
+         return ((a << 26) + b + 0.5) * (1. / 9007199254740992.);
+      }
+
+   private:
+      void NextBlock() {
+         unsigned int c[4] = { fCounter[0], fCounter[1], fCounter[2], fCounter[3] };
+         unsigned int k[2] = { fKey[0], fKey[1] };
+         for (int round = 0; round < 10; ++round) {
+            if (round > 0) {
+               k[0] += 0x9E3779B9;
+               k[1] += 0xBB67AE85;
+            }
+            unsigned long long p0 = 0xD2511F53ULL * c[0];
+            unsigned long long p1 = 0xCD9E8D57ULL * c[2];
+            unsigned int out0 = (unsigned int)(p1 >> 32) ^ c[1] ^ k[0];
+            unsigned int out2 = (unsigned int)(p0 >> 32) ^ c[3] ^ k[1];
+            c[0] = out0;
+            c[1] = (unsigned int) p1;
+            c[2] = out2;
+            c[3] = (unsigned int) p0;
+         }
+         for (int i = 0; i < 4; ++i) fOut[i] = c[i];
+         if (++fCounter[0] == 0) ++fCounter[1];
+         fUsed = 0;
+      }
+
+      unsigned int fKey[2];
+      unsigned int fCounter[4];
+      unsigned int fOut[4];
+      int fUsed;
+   };
+
+   double Poisson(Philox4x32 & rng, double mean) {
+      if (!(mean > 0)) return 0;
+
+      if (mean < 10) {
+         // inversion: walk up the CDF
+         double p = std::exp(-mean);
+         double cdf = p;
+         double u = rng.Uniform();
+         int k = 0;
+         while (u > cdf && k < 1000) {
+            ++k;
+            p *= mean / k;
+            cdf += p;
+         }
+         return k;
+      }
+
+      // PTRS, W. Hormann, Insurance: Mathematics and Economics 12 (1993) 39
+      const double smu = std::sqrt(mean);
+      const double b = 0.931 + 2.53 * smu;
+      const double a = -0.059 + 0.02483 * b;
+      const double invAlpha = 1.1239 + 1.1328 / (b - 3.4);
+      const double vr = 0.9277 - 3.6224 / (b - 2);
+      const double logMean = std::log(mean);
+      while (true) {
+         double u = rng.Uniform() - 0.5;
+         double v = rng.Uniform();
+         double us = 0.5 - std::fabs(u);
+         double k = std::floor((2 * a / us + b) * u + mean + 0.43);
+         if (us >= 0.07 && v <= vr) return k;
+         if (k < 0 || (us < 0.013 && v > us)) continue;
+         if (std::log(v * invAlpha / (a / (us * us) + b)) <= -mean + k * logMean - TMath::LnGamma(k + 1))
+            return k;
+      }
+   }
+
+} // end anonymous namespace
+
+
+
+RooStats::RazorToyGenerator::RazorToyGenerator(ModelConfig & mc) : fData(0) {
+
+   if (!mc.GetPdf() || !mc.GetObservables()) return;
+   if (!fModel.Read(*mc.GetPdf(), *mc.GetObservables())) {
+      Warning("RazorToyGenerator","Model %s is not a sum of two extended RooHistPdf templates times constraint terms",
+              mc.GetPdf()->GetName());
+      return;
+   }
+
+   // each global observable is drawn from the constraint term it appears in
+   if (mc.GetGlobalObservables()) {
+      TIterator * it = mc.GetGlobalObservables()->createIterator();
+      while (TObject * o = it->Next()) {
+         RooRealVar * g = dynamic_cast<RooRealVar*>(o);
+         RooAbsPdf * pdf = 0;
+         for (unsigned int i = 0; g && i < fModel.constraints.size(); ++i)
+            if (fModel.constraints[i]->dependsOn(*g)) pdf = fModel.constraints[i];
+         if (!g || !pdf || !g->hasMin() || !g->hasMax()) {
+            Warning("RazorToyGenerator","Cannot tabulate the global observable %s (no constraint term or no range)",
+                    o->GetName());
+            delete it;
+            return;
+         }
+         fGlobalObs.push_back(g);
+         fGlobalObsPdf.push_back(pdf);
+      }
+      delete it;
+   }
+   fTables[0].resize(fGlobalObs.size());
+   fTables[1].resize(fGlobalObs.size());
+
+   // the toy data set has the binning (and the observables) of the templates
+   fData = new RooDataHist(*fModel.hist[0], "razorToy");
+   fProb[0].assign(fData->numEntries(), 0.);
+   fProb[1].assign(fData->numEntries(), 0.);
+   for (int i = 0; i < fData->numEntries(); ++i) {
+      const RooArgSet * coord = fData->get(i);
+      int bin = fModel.Bin(((RooAbsReal*) coord->find(fModel.nameX.c_str()))->getVal(),
+                           ((RooAbsReal*) coord->find(fModel.nameY.c_str()))->getVal());
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,24,0)
+      double volume = fData->binVolume(i);
+#else
+      double volume = fData->binVolume();
+#endif
+      if (bin < 0) continue;
+      fProb[0][i] = fModel.density[0][bin] * volume * fModel.fraction[bin];
+      fProb[1][i] = fModel.density[1][bin] * volume * fModel.fraction[bin];
+   }
+}
+
+
+
+RooStats::RazorToyGenerator::~RazorToyGenerator() {
+   delete fData;
+}
+
+
+
+void
+RooStats::RazorToyGenerator::TabulateGlobalObservables(int hypothesis) {
+   //
+   // distribution of each global observable over its range, from its
+   // constraint term at the current parameter values: the mean and width
+   // of a Gaussian, else the CDF at the edges of kCells cells (with
+   // kNodes point Gauss-Legendre integrals) and, in each cell, the
+   // polynomial through the density at the nodes
+   //
+
+   if (!IsValid()) return;
+   for (unsigned int j = 0; j < fGlobalObs.size(); ++j) {
+      RooRealVar * g = fGlobalObs[j];
+      const RooAbsPdf * pdf = fGlobalObsPdf[j];
+      GlobalObsTable & table = fTables[hypothesis][j];
+      double saved = g->getVal();
+      double low = g->getMin();
+
+      table.gaussian = IsGaussian(*g, *pdf, table.mean, table.sigma) &&
+                       NormalMass(table.mean, table.sigma, low, g->getMax()) > 0;
+      if (table.gaussian) {
+         g->setVal(saved);
+         continue;
+      }
+
+      double width = (g->getMax() - low) / kCells;
+      table.cdf.assign(kCells + 1, 0.);
+      table.density.assign(kCells * kNodes, 0.);
+      for (int i = 0; i < kCells; ++i) {
+         double values[kNodes];
+         double mass = 0;
+         for (int k = 0; k < kNodes; ++k) {
+            g->setVal(low + (i + 0.5 * (1 + kNode[k])) * width);
+            values[k] = std::max(pdf->getVal(), 0.);
+            mass += 0.5 * kWeight[k] * values[k];
+         }
+         table.cdf[i + 1] = table.cdf[i] + mass;
+         Interpolate(values, &table.density[i * kNodes]);
+      }
+      g->setVal(saved);
+
+      // normalised, with the density in units of the cell fraction
+      double total = table.cdf[kCells];
+      for (int i = 0; i <= kCells; ++i)
+         table.cdf[i] = (total > 0) ? table.cdf[i] / total : double(i) / kCells;
+      for (int i = 0; i < kCells * kNodes; ++i)
+         table.density[i] = (total > 0) ? table.density[i] / total : ((i % kNodes == 0) ? 1. / kCells : 0.);
+   }
+}
+
+
+
+double
+RooStats::RazorToyGenerator::SampleGlobalObservable(int hypothesis, unsigned int j, double u) const {
+   //
+   // invert the CDF: exactly for a Gaussian, else by Newton iterations
+   // on the integral of the cell polynomial (with bisection when a step
+   // leaves the bracket of the root)
+   //
+
+   const RooRealVar * g = fGlobalObs[j];
+   const GlobalObsTable & table = fTables[hypothesis][j];
+   if (table.gaussian) return TruncatedNormal(table.mean, table.sigma, g->getMin(), g->getMax(), u);
+
+   const double * cdf = &table.cdf[0];
+   int cell = std::upper_bound(cdf, cdf + kCells + 1, u) - cdf - 1;
+   cell = std::max(0, std::min(cell, kCells - 1));
+   const double * c = &table.density[cell * kNodes];
+   double r = u - cdf[cell];
+   double dc = cdf[cell + 1] - cdf[cell];
+
+   double t = (dc > 0) ? std::max(0., std::min(1., r / dc)) : 0.5;
+   double lo = 0;
+   double hi = 1;
+   for (int iter = 0; iter < 100 && hi - lo > 1.E-15; ++iter) {
+      double mass = 0;
+      double density = 0;
+      for (int k = kNodes - 1; k >= 0; --k) {
+         mass = mass * t + c[k] / (k + 1);
+         density = density * t + c[k];
+      }
+      double h = mass * t - r;
+      if (h == 0) break;
+      if (h > 0) hi = t;
+      else lo = t;
+      double next = (density > 0) ? t - h / density : -1;
+      if (!(next > lo && next < hi)) next = 0.5 * (lo + hi);
+      bool done = std::fabs(next - t) <= 1.E-15;
+      t = next;
+      if (done) break;
+   }
+   return g->getMin() + (cell + t) * (g->getMax() - g->getMin()) / kCells;
+}
+
+
+
+RooDataHist *
+RooStats::RazorToyGenerator::Generate(unsigned int seed, int hypothesis, bool generateGlobalObs) {
+   if (!IsValid()) return 0;
+
+   Philox4x32 rng(seed);
+
+   if (generateGlobalObs) {
+      for (unsigned int j = 0; j < fGlobalObs.size(); ++j)
+         fGlobalObs[j]->setVal(SampleGlobalObservable(hypothesis, j, rng.Uniform()));
+   }
+
+   double nu0 = 0;
+   double nu1 = 0;
+   fModel.Yields(nu0, nu1);
+
+   const int nbins = fData->numEntries();
+   for (int i = 0; i < nbins; ++i) {
+      double n = Poisson(rng, nu0 * fProb[0][i] + nu1 * fProb[1][i]);
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,24,0)
+      fData->set(i, n, std::sqrt(n));
+#else
+      fData->get(i);
+      fData->set(n, std::sqrt(n));
+#endif
+   }
+   return fData;
+}
@@ -0,0 +1,91 @@
+/*
+ * Fast toy generator for the razor model built by workspace_preparer.C
+ * (see razor_nll.h for its shape).  The templates are fixed histograms,
+ * so a toy is only:
+ *
+ *   - the global observables (nom_lumi, nom_eff, nom_rho, nom_bprime),
+ *     drawn from their constraint terms,
+ *   - the yields S and B at the generation point,
+ *   - a Poisson count per (MR, RSQ) template bin, with mean
+ *     S * s_i + B * b_i.
+ *
+ * The counts are written into one RooDataHist with the template binning,
+ * allocated once and overwritten by every toy.  The distributions of the
+ * global observables are prepared once per scan point and hypothesis,
+ * since they depend only on the generation point.  A constraint term that
+ * is a Gaussian in its global observable (nom_lumi, nom_eff, nom_rho) is
+ * sampled exactly, as a normal truncated to the range of the observable.
+ * Any other (nom_bprime, the shape of a gamma) is tabulated in cells of
+ * Gauss-Legendre integrals, and inverted within its cell by Newton
+ * iterations on the interpolated density, to the rounding error.
+ *
+ * The random numbers come from a counter-based generator (Philox4x32-10)
+ * keyed by the toy seed, so each toy has its own stream and the threads
+ * of the ToyEngine generate without sharing, or locking, a generator.
+ *
+ * The generator is used by the ToyEngine (toy_engine.h) when fast toys
+ * are enabled.
+ */
+
+#ifndef RAZOR_TOYS_H
+#define RAZOR_TOYS_H
+
+#include <vector>
+
+#include "razor_nll.h"
+
+class RooRealVar;
+class RooDataHist;
+
+namespace RooStats {
+
+   class ModelConfig;
+
+   class RazorToyGenerator {
+
+   public:
+      // mc is the S+B model; the B toys use the same pdf at the B
+      // generation point.  The model must outlive the generator.
+      RazorToyGenerator(ModelConfig & mc);
+      ~RazorToyGenerator();
+
+      // false if the model does not have the razor shape
+      bool IsValid() const { return fData != 0; }
+
+      // Prepare the distributions of the global observables at the
+      // current parameter values, for hypothesis 0 (S+B) or 1 (B).
+      void TabulateGlobalObservables(int hypothesis);
+
+      // Generate one toy from seed: the global observables are set from
+      // the tables of the hypothesis (if generateGlobalObs), and the bin
+      // counts are drawn with the yields at the current parameter values.
+      // The data set is owned by the generator and overwritten by the
+      // next call.
+      RooDataHist * Generate(unsigned int seed, int hypothesis, bool generateGlobalObs);
+
+   private:
+      // distribution of a global observable, at a generation point
+      struct GlobalObsTable {
+         bool gaussian;                        // truncated normal, else cells
+         double mean;
+         double sigma;
+         std::vector<double> cdf;              // CDF at the cell edges
+         std::vector<double> density;          // polynomial of each cell (normalised)
+      };
+
+      double SampleGlobalObservable(int hypothesis, unsigned int i, double u) const;
+
+      RazorModel fModel;
+      RooDataHist * fData;                     // the reused toy data set
+      std::vector<double> fProb[2];            // template probabilities of the bins of fData
+      std::vector<RooRealVar*> fGlobalObs;
+      std::vector<RooAbsPdf*> fGlobalObsPdf;   // constraint term of each global observable
+      std::vector<GlobalObsTable> fTables[2];  // per hypothesis and global observable
+
+      RazorToyGenerator(const RazorToyGenerator &);
+      RazorToyGenerator & operator=(const RazorToyGenerator &);
+   };
+
+} // end namespace RooStats
+
+#endif
@@ -0,0 +1,819 @@
+/*
+ * Multi-threaded toy engine used by the HypoTestInvTool in
+ * StandardHypoTestInvDemo.C.  See toy_engine.h for an overview.
+ *
+ * Threads: with the binned razor likelihood (RazorBinnedNLL minimized by
+ * Minuit2) every thread owns a Slot, a clone of the workspace with its
+ * own ModelConfigs and test statistic, so the fits of different toys
+ * never touch the same pdfs or data sets.  RooFit generates from the
+ * single global RooRandom generator, so RooFit generation is serialized
+ * and the generator is reseeded with the toy seed before every toy.  With
+ * fast toys the razor toys are generated by each slot's
+ * RazorToyGenerator, from its own counter-based stream, without the lock.
+ * Threads need ROOT::EnableThreadSafety (ROOT 6.6 or later).
+ *
+ * Processes: the RooStats test statistics fit through RooMinimizer, whose
+ * static state, the RooFit evaluation error logging and the default
+ * minimizer options are shared by all threads.  With them (with the razor
+ * likelihood minimized by TMinuit, or before ROOT 6.6) the engine keeps a
+ * single slot and forks the workers once the point is prepared: worker k
+ * of n runs the toys k, k+n, ... on its copy of the slot, with its own
+ * RooRandom, and sends the values back through a pipe.
+ */
+
+#include <thread>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+#include <iostream>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#include "RVersion.h"
+#include "TROOT.h"
+#include "TRandom3.h"
+#include "TString.h"
+
+#include "RooRandom.h"
+#include "RooWorkspace.h"
+#include "RooAbsPdf.h"
+#include "RooAbsData.h"
+#include "RooDataSet.h"
+#include "RooDataHist.h"
+#include "RooRealVar.h"
+#include "RooArgSet.h"
+#include "RooFitResult.h"
+#include "RooGlobalFunc.h"
+
+#include "RooStats/ModelConfig.h"
+#include "RooStats/RooStatsUtils.h"
+#include "RooStats/HypoTestResult.h"
+#include "RooStats/HypoTestInverterResult.h"
+#include "RooStats/SamplingDistribution.h"
+#include "RooStats/NumEventsTestStat.h"
+#include "RooStats/ProfileLikelihoodTestStat.h"
+#include "RooStats/SimpleLikelihoodRatioTestStat.h"
+#include "RooStats/RatioOfProfiledLikelihoodsTestStat.h"
+#include "RooStats/MaxLikelihoodEstimateTestStat.h"
+
+#include "razor_nll.h"
+#include "razor_toys.h"
+#include "toy_engine.h"
+#include "profiler.h"
+
+using namespace RooFit;
+using namespace RooStats;
+
+
+namespace {
+
+   std::mutex gRandomMutex;   // guards RooRandom::randomGenerator()
+   std::mutex gJobMutex;      // guards the toy counter of a point
+
+   // mixing function of the splitmix64 generator, used to derive the
+   // per-toy seeds
+   ULong64_t SplitMix64(ULong64_t x) {
+      x += 0x9E3779B97F4A7C15ULL;
+      x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+      return x ^ (x >> 31);
+   }
+
+   // Copy a ModelConfig so that it refers to the workspace ws.  Sets and
+   // snapshots are matched by name, so the original may belong to
+   // another workspace.
+   ModelConfig * CloneModelConfig(const ModelConfig & mc, RooWorkspace & ws) {
+      ModelConfig * c = new ModelConfig(mc.GetName(), &ws);
+      c->SetPdf(mc.GetPdf()->GetName());
+      if (mc.GetObservables()) c->SetObservables(*mc.GetObservables());
+      if (mc.GetParametersOfInterest()) c->SetParametersOfInterest(*mc.GetParametersOfInterest());
+      if (mc.GetNuisanceParameters()) c->SetNuisanceParameters(*mc.GetNuisanceParameters());
+      if (mc.GetGlobalObservables()) c->SetGlobalObservables(*mc.GetGlobalObservables());
+      if (mc.GetPriorPdf()) c->SetPriorPdf(mc.GetPriorPdf()->GetName());
+      if (mc.GetSnapshot()) c->SetSnapshot(*mc.GetSnapshot());
+      return c;
+   }
+
+   RooAbsData * GenerateToy(RooAbsPdf & pdf, const RooArgSet & obs,
+                            int nevents, bool binned) {
+      if (binned) {
+         if (nevents > 0) return pdf.generateBinned(obs, nevents);
+         return pdf.generateBinned(obs, Extended());
+      }
+      if (nevents > 0) return pdf.generate(obs, nevents);
+      return pdf.generate(obs, Extended());
+   }
+
+#ifndef _WIN32
+   // write or read n bytes through a pipe; false on an error or at the end
+   // of the file
+   bool WriteAll(int fd, const void * buffer, size_t n) {
+      const char * p = (const char *) buffer;
+      while (n > 0) {
+         ssize_t done = write(fd, p, n);
+         if (done < 0 && errno == EINTR) continue;
+         if (done <= 0) return false;
+         p += done;
+         n -= done;
+      }
+      return true;
+   }
+
+   bool ReadAll(int fd, void * buffer, size_t n) {
+      char * p = (char *) buffer;
+      while (n > 0) {
+         ssize_t done = read(fd, p, n);
+         if (done < 0 && errno == EINTR) continue;
+         if (done <= 0) return false;
+         p += done;
+         n -= done;
+      }
+      return true;
+   }
+#endif
+
+} // end anonymous namespace
+
+
+struct RooStats::ToyEngine::Slot {
+   Slot() : ws(0), sbModel(0), bModel(0), data(0), testStat(0),
+            nuisPdf(0), ownNuisPdf(false), params(0), nuis(0),
+            globalObs(0), nominalGlobalObs(0), fastGen(0) {}
+   ~Slot() {
+      delete fastGen;
+      delete testStat;
+      if (ownNuisPdf) delete nuisPdf;
+      delete params;
+      delete nuis;
+      delete globalObs;
+      delete nominalGlobalObs;
+      delete sbModel;
+      delete bModel;
+      delete ws;
+   }
+
+   RooWorkspace * ws;
+   ModelConfig * sbModel;
+   ModelConfig * bModel;
+   RooAbsData * data;
+   TestStatistic * testStat;
+   RooAbsPdf * nuisPdf;               // prior of the nuisance parameters (hybrid only)
+   bool ownNuisPdf;
+   RooArgSet * params;                // POI + nuisance parameters (not owned)
+   RooArgSet * nuis;                  // nuisance parameters (not owned)
+   RooArgSet * globalObs;             // global observables (not owned), 0 if none
+   RooArgSet * nominalGlobalObs;      // snapshot of the global observables
+   RazorToyGenerator * fastGen;       // fast toy generator, 0 if not used
+};
+
+
+
+TestStatistic *
+RooStats::BuildTestStatistic(ModelConfig & sbModel, ModelConfig & bModel,
+                             int testStatType, const char * minimizerType,
+                             int printLevel, bool optimize, bool fastNLL){
+   //
+   // create the test statistic used by the hypotest calculators
+   //
+
+   if (fastNLL && testStatType >= 1 && testStatType <= 4) {
+      RazorBinnedNLL * rnll = new RazorBinnedNLL(sbModel, bModel, testStatType);
+      if (rnll->IsValid()) rnll->SetMinimizer(minimizerType);
+      if (rnll->IsValid()) {
+         rnll->SetPrintLevel(printLevel);
+         if (optimize) rnll->SetStrategy(0);
+         return rnll;
+      }
+      Warning("BuildTestStatistic","Cannot use the binned razor likelihood - use the RooStats test statistic");
+      delete rnll;
+   }
+
+   if (testStatType == 0) {
+      SimpleLikelihoodRatioTestStat * slrts =
+         new SimpleLikelihoodRatioTestStat(*sbModel.GetPdf(), *bModel.GetPdf());
+      // null parameters must includes snapshot of poi plus the nuisance values
+      if (sbModel.GetSnapshot()) {
+         RooArgSet nullParams(*sbModel.GetSnapshot());
+         if (sbModel.GetNuisanceParameters()) nullParams.add(*sbModel.GetNuisanceParameters());
+         slrts->SetNullParameters(nullParams);
+      }
+      if (bModel.GetSnapshot()) {
+         RooArgSet altParams(*bModel.GetSnapshot());
+         if (bModel.GetNuisanceParameters()) altParams.add(*bModel.GetNuisanceParameters());
+         slrts->SetAltParameters(altParams);
+      }
+      slrts->SetReuseNLL(optimize);
+      return slrts;
+   }
+
+   if (testStatType == 1 || testStatType == 11) {
+      // ratio of profile likelihood - need to pass snapshot for the alt
+      RatioOfProfiledLikelihoodsTestStat * ropl =
+         new RatioOfProfiledLikelihoodsTestStat(*sbModel.GetPdf(), *bModel.GetPdf(), bModel.GetSnapshot());
+      ropl->SetSubtractMLE(testStatType == 11);
+      ropl->SetPrintLevel(printLevel);
+      ropl->SetMinimizer(minimizerType);
+      ropl->SetReuseNLL(optimize);
+      if (optimize) ropl->SetStrategy(0);
+      return ropl;
+   }
+
+   if (testStatType == 2 || testStatType == 3 || testStatType == 4) {
+      ProfileLikelihoodTestStat * profll = new ProfileLikelihoodTestStat(*sbModel.GetPdf());
+      if (testStatType == 3) profll->SetOneSided(true);
+      if (testStatType == 4) profll->SetSigned(true);
+      profll->SetMinimizer(minimizerType);
+      profll->SetPrintLevel(printLevel);
+      profll->SetReuseNLL(optimize);
+      if (optimize) profll->SetStrategy(0);
+      return profll;
+   }
+
+   if (testStatType == 5) {
+      RooRealVar * poi = (RooRealVar*) sbModel.GetParametersOfInterest()->first();
+      return new MaxLikelihoodEstimateTestStat(*sbModel.GetPdf(), *poi);
+   }
+
+   if (testStatType == 6) return new NumEventsTestStat();
+
+   return 0;
+}
+
+
+
+RooAbsData *
+RooStats::ProfiledToyMCSampler::GenerateToyData(RooArgSet & paramPoint, double & weight,
+                                                RooAbsPdf & pdf) const {
+   double start = Profiler::Now();
+   RooAbsData * toy = ToyMCSampler::GenerateToyData(paramPoint, weight, pdf);
+   double seconds = Profiler::Now() - start;
+   fGeneration += seconds;
+   Profiler::Instance().AddTime("toy_generation", seconds);
+   return toy;
+}
+
+
+
+RooDataSet *
+RooStats::ProfiledToyMCSampler::GetSamplingDistributionsSingleWorker(RooArgSet & paramPoint) {
+   //
+   // one call per hypothesis and point (or batch): the test statistic
+   // timer gets one entry per call, not per toy as in the engine
+   //
+
+   fGeneration = 0;
+   double start = Profiler::Now();
+   RooDataSet * toys = ToyMCSampler::GetSamplingDistributionsSingleWorker(paramPoint);
+   Profiler::Instance().AddTime("test_statistic", Profiler::Now() - start - fGeneration);
+   if (toys) Profiler::Instance().Count("toys", toys->numEntries());
+   return toys;
+}
+
+
+
+RooStats::ToyEngine::ToyEngine(RooWorkspace * w, const ModelConfig & sbModel,
+                               const ModelConfig & bModel, const char * dataName,
+                               int type, int nThreads) : fWorkspace(w),
+                                                         fSBModel(&sbModel),
+                                                         fBModel(&bModel),
+                                                         fDataName(dataName),
+                                                         fNWorkers(std::max(nThreads, 1)),
+                                                         fForkWorkers(false),
+                                                         fNullGen(0),
+                                                         fAltGen(0),
+                                                         fFitCache(0),
+                                                         fType(type),
+                                                         fNEventsPerToy(0),
+                                                         fGenerateBinned(false),
+                                                         fFastToys(false),
+                                                         fWarm(false),
+                                                         fStarted(false),
+                                                         fPoint(0),
+                                                         fObsValue(0),
+                                                         fSeed(4357),
+                                                         fMinimizerType(""),
+                                                         fNuisPriorName("") {
+
+   // the other slots, if any, are made by SetTestStatistic
+   Slot * s = NewSlot();
+   if (s) fSlots.push_back(s);
+}
+
+
+
+RooStats::ToyEngine::~ToyEngine() {
+   for (unsigned int i = 0; i < fSlots.size(); ++i) delete fSlots[i];
+   delete fNullGen;
+   delete fAltGen;
+   delete fFitCache;
+}
+
+
+
+RooStats::ToyEngine::Slot *
+RooStats::ToyEngine::NewSlot() const {
+   //
+   // clone the workspace, the models and the data set (in the calling
+   // thread); 0 if they cannot be found in the clone
+   //
+
+   Slot * s = new Slot();
+   s->ws = new RooWorkspace(*fWorkspace);
+   s->sbModel = CloneModelConfig(*fSBModel, *s->ws);
+   s->bModel = CloneModelConfig(*fBModel, *s->ws);
+   s->data = s->ws->data(fDataName.c_str());
+   if (!s->data || !s->sbModel->GetPdf() || !s->bModel->GetPdf()) {
+      Error("ToyEngine","Cannot clone the models or the data set %s into the thread workspace",fDataName.c_str());
+      delete s;
+      return 0;
+   }
+
+   s->params = new RooArgSet(*s->sbModel->GetParametersOfInterest());
+   s->nuis = new RooArgSet();
+   if (s->sbModel->GetNuisanceParameters()) {
+      s->nuis->add(*s->sbModel->GetNuisanceParameters());
+      s->params->add(*s->nuis);
+   }
+   const RooArgSet * gobs = s->sbModel->GetGlobalObservables();
+   if (fType != 1 && gobs && gobs->getSize() > 0) {
+      s->globalObs = new RooArgSet(*gobs);
+      s->nominalGlobalObs = (RooArgSet*) gobs->snapshot();
+   }
+   return s;
+}
+
+
+
+void
+RooStats::ToyEngine::SetTestStatistic(int testStatType, const char * minimizerType,
+                                      int printLevel, bool optimize, bool fastNLL) {
+   //
+   // build the test statistic of the first slot, and choose how the toys
+   // run in parallel.  The razor likelihood minimized by Minuit2 runs in
+   // threads, each with its own slot and test statistic; the razor
+   // likelihoods share one fit cache, filled by the fits of the observed
+   // data of the first slot (which are done before the threads start).
+   // The other test statistics run in forked worker processes
+   //
+
+   fMinimizerType = minimizerType;
+   delete fFitCache;
+   fFitCache = new RazorFitCache();
+   for (unsigned int i = 1; i < fSlots.size(); ++i) delete fSlots[i];
+   fSlots.resize(1);
+
+   Slot * s0 = fSlots[0];
+   delete s0->testStat;
+   s0->testStat = BuildTestStatistic(*s0->sbModel, *s0->bModel, testStatType,
+                                     minimizerType, printLevel, optimize, fastNLL);
+   RazorBinnedNLL * rnll = dynamic_cast<RazorBinnedNLL*>(s0->testStat);
+   if (rnll) rnll->SetFitCache(fFitCache, s0->data);
+
+   bool threads = (fNWorkers > 1 && rnll && rnll->IsThreadSafe());
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+   if (threads) ROOT::EnableThreadSafety();
+#else
+   threads = false;
+#endif
+   for (int i = 1; threads && i < fNWorkers; ++i) {
+      Slot * s = NewSlot();
+      if (!s) break;
+      s->testStat = BuildTestStatistic(*s->sbModel, *s->bModel, testStatType,
+                                       minimizerType, printLevel, optimize, fastNLL);
+      RazorBinnedNLL * snll = dynamic_cast<RazorBinnedNLL*>(s->testStat);
+      if (snll) snll->SetFitCache(fFitCache, 0);
+      fSlots.push_back(s);
+   }
+
+   fForkWorkers = (!threads && fNWorkers > 1);
+#ifdef _WIN32
+   if (fForkWorkers) {
+      Warning("ToyEngine","The test statistic of type %d cannot be evaluated in several threads, "
+              "and worker processes are not supported on Windows - run the toys in one thread",testStatType);
+      fForkWorkers = false;
+   }
+#endif
+   fWarm = false;
+   fStarted = false;
+}
+
+
+
+void
+RooStats::ToyEngine::SetSeed(int seed) {
+   //
+   // base seed of the toys (-1 : default value, 0 : random)
+   //
+
+   if (seed > 0) fSeed = seed;
+   else if (seed == 0) {
+      TRandom3 rndm(0);
+      fSeed = rndm.Integer(kMaxUInt);
+      std::cout << "ToyEngine : using random base seed " << fSeed << std::endl;
+   }
+   else fSeed = 4357;
+}
+
+
+
+void
+RooStats::ToyEngine::SetNuisancePrior(const char * nuisPriorName) {
+   if (nuisPriorName) fNuisPriorName = nuisPriorName;
+   fWarm = false;
+   fStarted = false;
+}
+
+
+
+unsigned int
+RooStats::ToyEngine::ToySeed(double poival, int hypothesis, int toy) const {
+   //
+   // seed of a single toy; it depends only on the base seed, the POI
+   // value, the hypothesis and the toy index
+   //
+
+   ULong64_t bits = 0;
+   std::memcpy(&bits, &poival, sizeof(bits));
+   ULong64_t h = SplitMix64(fSeed);
+   h = SplitMix64(h ^ bits);
+   h = SplitMix64(h ^ ((ULong64_t(hypothesis) << 32) | UInt_t(toy)));
+   UInt_t seed = UInt_t(h ^ (h >> 32));
+   return (seed == 0) ? 1 : seed;   // TRandom3 takes 0 as "random seed"
+}
+
+
+
+HypoTestInverterResult *
+RooStats::ToyEngine::CreateResult(double cl, bool useCLs) const {
+   if (fSlots.empty()) return 0;
+   RooRealVar * poi = (RooRealVar*) fSlots[0]->sbModel->GetParametersOfInterest()->first();
+   HypoTestInverterResult * r =
+      new HypoTestInverterResult(TString::Format("result_%s",poi->GetName()), *poi, cl);
+   r->UseCLs(useCLs);
+   return r;
+}
+
+
+
+void
+RooStats::ToyEngine::WarmUp(double poival) {
+   //
+   // things that create new RooFit objects are done once per slot, in
+   // the calling thread, before the worker threads are started.  The
+   // first evaluation is done as the one of the observed data at poival,
+   // so that the razor fit cache gets the same entry as without it
+   //
+
+   bool fast = fFastToys;
+   if (fast && fNEventsPerToy > 0) {
+      Warning("ToyEngine","Fast toys are extended - use RooFit for toys of %d events",fNEventsPerToy);
+      fast = false;
+   }
+   if (fast && std::strcmp(fSlots[0]->sbModel->GetPdf()->GetName(), fSlots[0]->bModel->GetPdf()->GetName()) != 0) {
+      Warning("ToyEngine","Fast toys need the same pdf for the S+B and B models - use RooFit");
+      fast = false;
+   }
+
+   for (unsigned int i = 0; i < fSlots.size(); ++i) {
+      Slot * s = fSlots[i];
+      if (!fast) {
+         delete s->fastGen;
+         s->fastGen = 0;
+      }
+      else if (!s->fastGen) {
+         s->fastGen = new RazorToyGenerator(*s->sbModel);
+         if (!s->fastGen->IsValid()) {
+            Warning("ToyEngine","Cannot use the fast toy generator - use RooFit");
+            for (unsigned int j = 0; j <= i; ++j) {
+               delete fSlots[j]->fastGen;
+               fSlots[j]->fastGen = 0;
+            }
+            fast = false;
+         }
+      }
+
+      if (fType == 1 && s->nuis->getSize() > 0 && !s->nuisPdf) {
+         if (fNuisPriorName.size() > 0) s->nuisPdf = s->ws->pdf(fNuisPriorName.c_str());
+         if (!s->nuisPdf) {
+            s->nuisPdf = RooStats::MakeNuisancePdf(*s->bModel,"nuisancePdf_bmodel");
+            s->ownNuisPdf = (s->nuisPdf != 0);
+         }
+         if (!s->nuisPdf) s->nuisPdf = s->bModel->GetPriorPdf();
+         if (!s->nuisPdf)
+            Warning("ToyEngine","No prior for the nuisance parameters - they are not smeared");
+      }
+
+      // the first evaluation builds the NLL (reused afterwards)
+      RooArgSet * nullPOI = (RooArgSet*) s->sbModel->GetParametersOfInterest()->snapshot();
+      ((RooRealVar*) nullPOI->first())->setVal(poival);
+      *s->params = *fNullGen;
+      if (s->globalObs) *s->globalObs = *s->nominalGlobalObs;
+      s->testStat->Evaluate(*s->data, *nullPOI);
+      delete nullPOI;
+   }
+   fWarm = true;
+}
+
+
+
+void
+RooStats::ToyEngine::SetGenerationPoint(double poival, bool isNull) {
+   //
+   // find the parameter point used to generate the toys of one
+   // hypothesis.  As in the FrequentistCalculator the nuisance
+   // parameters are profiled on the data at the POI value of the
+   // hypothesis; for the hybrid case they are smeared toy by toy.
+   //
+
+   Slot * s = fSlots[0];
+   ModelConfig * mc = isNull ? s->sbModel : s->bModel;
+   RooRealVar * poi = (RooRealVar*) s->sbModel->GetParametersOfInterest()->first();
+
+   if (mc->GetSnapshot()) *s->params = *mc->GetSnapshot();
+   if (isNull) poi->setVal(poival);
+   if (s->globalObs) *s->globalObs = *s->nominalGlobalObs;
+
+   RooArgSet constrainParams(*s->nuis);
+   RooStats::RemoveConstantParameters(&constrainParams);
+   if (fType == 0 && constrainParams.getSize() > 0) {
+      PROFILE_SCOPE("generation_point_fit");
+      bool poiConst = poi->isConstant();
+      poi->setConstant(true);
+      RooFitResult * fitres = mc->GetPdf()->fitTo(*s->data, InitialHesse(false), Hesse(false),
+                                                  Minimizer(fMinimizerType.c_str(),"Migrad"), Strategy(0),
+                                                  PrintLevel(-1), Constrain(constrainParams), Save(true));
+      if (!fitres || fitres->status() != 0) {
+         Profiler::Instance().Count("generation_point_fit_failures");
+         Warning("ToyEngine","Fit of the nuisance parameters at %s = %g failed - continue anyway",
+                 poi->GetName(), poi->getVal());
+      }
+      delete fitres;
+      poi->setConstant(poiConst);
+   }
+
+   RooArgSet *& gen = isNull ? fNullGen : fAltGen;
+   delete gen;
+   gen = (RooArgSet*) s->params->snapshot();
+}
+
+
+
+void
+RooStats::ToyEngine::RunToys(Slot * s, double poival, int firstToySB, int firstToyB,
+                             int ntoysSB, int ntoysB, int * next, int worker, int nWorkers,
+                             std::vector<ToyOutput> * toys) {
+   //
+   // body of a worker: run the toys of the point and store them in toys,
+   // S+B toys first.  With next the toys are taken from this common
+   // counter until all of them are done (threads); without it the worker
+   // runs the toys worker, worker + nWorkers, ... (processes)
+   //
+
+   RooArgSet * nullPOI = (RooArgSet*) s->sbModel->GetParametersOfInterest()->snapshot();
+   ((RooRealVar*) nullPOI->first())->setVal(poival);
+   const RooArgSet & obs = *s->sbModel->GetObservables();
+
+   // the RooStats test statistics keep the data set in their NLL, whose
+   // caches are not refreshed for the same object with new contents: they
+   // get a copy of the data set of the fast generator
+   bool copyToy = s->fastGen && !dynamic_cast<RazorBinnedNLL*>(s->testStat);
+
+   for (int k = 0; ; ++k) {
+      int job = worker + k * nWorkers;
+      if (next) {
+         std::lock_guard<std::mutex> lock(gJobMutex);
+         job = (*next)++;
+      }
+      if (job >= ntoysSB + ntoysB) break;
+
+      bool isNull = (job < ntoysSB);
+      int index = isNull ? job : job - ntoysSB;
+      ModelConfig * mc = isNull ? s->sbModel : s->bModel;
+
+      // every toy starts from the generation point (values and errors, the
+      // step sizes of RooMinimizer), so that the fit does not depend on the
+      // toys previously run by this worker
+      *s->params = isNull ? *fNullGen : *fAltGen;
+
+      unsigned int seed = ToySeed(poival, isNull ? 0 : 1, (isNull ? firstToySB : firstToyB) + index);
+      RooAbsData * toy = 0;
+      double start = Profiler::Now();
+      if (s->fastGen) {
+         if (s->nuisPdf) {
+            std::lock_guard<std::mutex> lock(gRandomMutex);
+            RooRandom::randomGenerator()->SetSeed(seed);
+            RooDataSet * np = s->nuisPdf->generate(*s->nuis, 1);
+            if (np) *s->params = *np->get(0);
+            delete np;
+         }
+         // owned by the generator
+         toy = s->fastGen->Generate(seed, isNull ? 0 : 1, s->globalObs != 0);
+         if (toy && copyToy) toy = new RooDataHist(*(RooDataHist*) toy);
+      }
+      else {
+         std::lock_guard<std::mutex> lock(gRandomMutex);
+         RooRandom::randomGenerator()->SetSeed(seed);
+         if (s->nuisPdf) {
+            RooDataSet * np = s->nuisPdf->generate(*s->nuis, 1);
+            if (np) *s->params = *np->get(0);
+            delete np;
+         }
+         if (s->globalObs) {
+            RooDataSet * one = mc->GetPdf()->generate(*s->globalObs, 1);
+            if (one) *s->globalObs = *one->get(0);
+            delete one;
+         }
+         toy = GenerateToy(*mc->GetPdf(), obs, fNEventsPerToy, fGenerateBinned);
+      }
+
+      double generated = Profiler::Now();
+      ToyOutput & out = (*toys)[job];
+      out.value = (toy) ? s->testStat->Evaluate(*toy, *nullPOI) : 0;
+      out.generation = generated - start;
+      out.evaluation = Profiler::Now() - generated;
+      if (!s->fastGen || copyToy) delete toy;
+   }
+
+   if (s->globalObs) *s->globalObs = *s->nominalGlobalObs;
+   delete nullPOI;
+}
+
+
+
+bool
+RooStats::ToyEngine::RunWorkers(double poival, int firstToySB, int firstToyB,
+                                int ntoysSB, int ntoysB, std::vector<ToyOutput> & toys) {
+   //
+   // run the toys in fNWorkers forked processes, each on its copy of the
+   // first slot.  The shares of the workers that cannot be started are run
+   // here.  The profiling of the fits inside the test statistic is lost in
+   // the workers (the toy timings are sent back with the values)
+   //
+
+   std::vector<int> pids;
+   std::vector<int> pipes;
+#ifndef _WIN32
+   std::cout.flush();
+   std::cerr.flush();
+   std::fflush(0);
+   for (int w = 0; w < fNWorkers; ++w) {
+      int fd[2];
+      if (pipe(fd) != 0) break;
+      pid_t pid = fork();
+      if (pid < 0) {
+         close(fd[0]);
+         close(fd[1]);
+         break;
+      }
+      if (pid == 0) {
+         // worker: run its share and send (index, output) pairs
+         close(fd[0]);
+         for (unsigned int i = 0; i < pipes.size(); ++i) close(pipes[i]);
+         RunToys(fSlots[0], poival, firstToySB, firstToyB, ntoysSB, ntoysB, 0, w, fNWorkers, &toys);
+         bool ok = true;
+         for (int job = w; ok && job < ntoysSB + ntoysB; job += fNWorkers)
+            ok = WriteAll(fd[1], &job, sizeof(job)) && WriteAll(fd[1], &toys[job], sizeof(ToyOutput));
+         close(fd[1]);
+         _exit(ok ? 0 : 1);
+      }
+      close(fd[1]);
+      pids.push_back(pid);
+      pipes.push_back(fd[0]);
+   }
+#endif
+   if (int(pids.size()) < fNWorkers)
+      Warning("ToyEngine","Could start only %d of %d worker processes - run the other toys here",
+              int(pids.size()),fNWorkers);
+   for (int w = pids.size(); w < fNWorkers; ++w)
+      RunToys(fSlots[0], poival, firstToySB, firstToyB, ntoysSB, ntoysB, 0, w, fNWorkers, &toys);
+
+   bool ok = true;
+#ifndef _WIN32
+   std::vector<bool> received(toys.size(), false);
+   for (unsigned int w = 0; w < pipes.size(); ++w) {
+      int job = 0;
+      ToyOutput out;
+      while (ReadAll(pipes[w], &job, sizeof(job)) && ReadAll(pipes[w], &out, sizeof(out))) {
+         if (job < 0 || job >= int(toys.size())) continue;
+         toys[job] = out;
+         received[job] = true;
+      }
+      close(pipes[w]);
+      int status = 0;
+      waitpid(pids[w], &status, 0);
+      for (int job = w; job < int(toys.size()); job += fNWorkers) ok = ok && received[job];
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+   }
+#endif
+   if (!ok) Error("ToyEngine","A worker process failed at %g",poival);
+   return ok;
+}
+
+
+
+bool
+RooStats::ToyEngine::StartPoint(double poival) {
+   //
+   // generation points, fast generator tables and observed test statistic
+   // of the point poival, shared by all the batches of toys run at it
+   //
+
+   if (fSlots.empty()) return false;
+   if (!fSlots[0]->testStat) {
+      Error("ToyEngine","No test statistic has been set");
+      return false;
+   }
+
+   SetGenerationPoint(0, false);
+   SetGenerationPoint(poival, true);
+   if (!fWarm) WarmUp(poival);
+
+   // the global observable tables of the fast generators depend on the
+   // generation points
+   for (unsigned int i = 0; i < fSlots.size(); ++i) {
+      Slot * s = fSlots[i];
+      if (!s->fastGen || !s->globalObs) continue;
+      *s->params = *fNullGen;
+      s->fastGen->TabulateGlobalObservables(0);
+      *s->params = *fAltGen;
+      s->fastGen->TabulateGlobalObservables(1);
+   }
+
+   // test statistic on the observed data (always from the first slot)
+   Slot * s0 = fSlots[0];
+   RooArgSet * nullPOI = (RooArgSet*) s0->sbModel->GetParametersOfInterest()->snapshot();
+   ((RooRealVar*) nullPOI->first())->setVal(poival);
+   *s0->params = *fNullGen;
+   if (s0->globalObs) *s0->globalObs = *s0->nominalGlobalObs;
+   {
+      PROFILE_SCOPE("test_statistic_data");
+      fObsValue = s0->testStat->Evaluate(*s0->data, *nullPOI);
+   }
+   delete nullPOI;
+
+   fPoint = poival;
+   fStarted = true;
+   return true;
+}
+
+
+
+bool
+RooStats::ToyEngine::RunPoint(double poival, int ntoysSB, int ntoysB, int firstToySB,
+                              int firstToyB, HypoTestInverterResult * r) {
+   //
+   // run the toys of one scan point and add them to r
+   //
+
+   if (!r) return false;
+   if ((!fStarted || poival != fPoint) && !StartPoint(poival)) return false;
+   Slot * s0 = fSlots[0];
+
+   ntoysSB = std::max(ntoysSB, 0);
+   ntoysB = std::max(ntoysB, 0);
+   std::vector<ToyOutput> toys(ntoysSB + ntoysB);
+   int next = 0;
+
+   if (fForkWorkers) {
+      if (!RunWorkers(poival, firstToySB, firstToyB, ntoysSB, ntoysB, toys)) return false;
+   }
+   else if (fSlots.size() == 1)
+      RunToys(s0, poival, firstToySB, firstToyB, ntoysSB, ntoysB, &next, 0, 1, &toys);
+   else {
+      std::vector<std::thread> threads;
+      for (unsigned int i = 0; i < fSlots.size(); ++i)
+         threads.push_back(std::thread(&ToyEngine::RunToys, this, fSlots[i], poival, firstToySB, firstToyB,
+                                       ntoysSB, ntoysB, &next, 0, 1, &toys));
+      for (unsigned int i = 0; i < threads.size(); ++i) threads[i].join();
+   }
+
+   // merge the toys of all workers into one result for this point
+   std::vector<double> nullValues(ntoysSB);
+   std::vector<double> altValues(ntoysB);
+   for (unsigned int job = 0; job < toys.size(); ++job) {
+      if (int(job) < ntoysSB) nullValues[job] = toys[job].value;
+      else altValues[job - ntoysSB] = toys[job].value;
+      Profiler::Instance().AddTime("toy_generation", toys[job].generation);
+      Profiler::Instance().AddTime("test_statistic", toys[job].evaluation);
+   }
+   Profiler::Instance().Count("toys", toys.size());
+
+   TestStatistic * ts = s0->testStat;
+   TString tsName = ts->GetVarName();
+   RooRealVar * poi = (RooRealVar*) s0->sbModel->GetParametersOfInterest()->first();
+   HypoTestResult res(TString::Format("HypoTestResult_%s_%g",poi->GetName(),poival));
+   res.SetPValueIsRightTail(ts->PValueIsRightTail());
+   res.SetTestStatisticData(fObsValue);
+   if (nullValues.size() > 0)
+      res.SetNullDistribution(new SamplingDistribution("null","S+B toys",nullValues,tsName));
+   if (altValues.size() > 0)
+      res.SetAltDistribution(new SamplingDistribution("alt","B toys",altValues,tsName));
+   res.SetBackgroundAsAlt(true);
+
+   return r->Add(poival, res);
+}
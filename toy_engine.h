@@ -0,0 +1,163 @@
+/*
+ * Local, multi-threaded toy engine for the frequentist and hybrid
+ * calculators.  It replaces the PROOF-Lite option of the
+ * HypoTestInvTool: with the binned razor likelihood of razor_nll.h
+ * (fastNLL) every thread works on its own clone of the RooWorkspace (and
+ * therefore on its own ModelConfigs, pdfs and test statistic).
+ *
+ * The RooStats test statistics share the static state of RooMinimizer
+ * and of RooFit, so they cannot run in threads.  With them the engine
+ * forks worker processes from the prepared point instead (no workspace
+ * is sent, and nothing is set up again in the workers; not available on
+ * Windows).  The razor likelihood also runs in processes before ROOT 6.6.
+ *
+ * Every toy gets its own seed, derived from the random seed, the scanned
+ * POI value, the hypothesis and the toy index.  The test statistic value
+ * of toy i is always stored in slot i of the sampling distribution, so
+ * the result does not depend on the number of workers used.  For the same
+ * reason the fit cache of the razor likelihood (razor_nll.h) is shared by
+ * the threads and filled only with the fits of the observed data.
+ *
+ * The implementation lives in toy_engine.cxx and needs a compiler with
+ * thread support (run the macro through ACLiC or the compiled driver).
+ */
+
+#ifndef TOY_ENGINE_H
+#define TOY_ENGINE_H
+
+#include <string>
+#include <vector>
+
+#include "RooStats/ToyMCSampler.h"
+
+class RooWorkspace;
+class RooArgSet;
+
+namespace RooStats {
+
+   class ModelConfig;
+   class TestStatistic;
+   class HypoTestInverterResult;
+   class RazorFitCache;
+
+   // Build the test statistic of type testStatType (see
+   // StandardHypoTestInvDemo.C for the list of types) for the given
+   // models.  With fastNLL the profile likelihood types (1 to 4) use the
+   // binned razor likelihood of razor_nll.h when the model allows it.
+   // The caller owns the returned object.
+   TestStatistic * BuildTestStatistic(ModelConfig & sbModel, ModelConfig & bModel,
+                                      int testStatType, const char * minimizerType,
+                                      int printLevel, bool optimize,
+                                      bool fastNLL = false);
+
+   // ToyMCSampler of the RooStats toy loop (without the engine) that adds
+   // its generation time to the "toy_generation" timer of the Profiler,
+   // and the rest of each sampling (the test statistic of the toys, and
+   // the nuisance parameters of the hybrid calculator) to the
+   // "test_statistic" timer.  Not for PROOF: the class has no dictionary.
+   class ProfiledToyMCSampler : public ToyMCSampler {
+
+   public:
+      ProfiledToyMCSampler(TestStatistic & ts, Int_t ntoys) : ToyMCSampler(ts, ntoys), fGeneration(0) {}
+
+      using ToyMCSampler::GenerateToyData;
+      virtual RooAbsData * GenerateToyData(RooArgSet & paramPoint, double & weight, RooAbsPdf & pdf) const;
+      virtual RooDataSet * GetSamplingDistributionsSingleWorker(RooArgSet & paramPoint);
+
+   private:
+      mutable double fGeneration;              // generation time of the current sampling
+   };
+
+   class ToyEngine {
+
+   public:
+      // type is the calculator type (0 frequentist, 1 hybrid).  The
+      // workspace is cloned once per thread, and must outlive the engine;
+      // the models may live outside of it as long as their pdfs and
+      // parameters are defined in it.
+      ToyEngine(RooWorkspace * w, const ModelConfig & sbModel,
+                const ModelConfig & bModel, const char * dataName,
+                int type, int nThreads);
+      ~ToyEngine();
+
+      // must be called before the first point is run
+      void SetTestStatistic(int testStatType, const char * minimizerType,
+                            int printLevel, bool optimize, bool fastNLL = false);
+      void SetSeed(int seed);
+      void SetNuisancePrior(const char * nuisPriorName);
+      void SetNEventsPerToy(int nevents) { fNEventsPerToy = nevents; }
+      void SetGenerateBinned(bool binned) { fGenerateBinned = binned; }
+
+      // Generate the toys with the RazorToyGenerator of razor_toys.h
+      // instead of RooFit (extended toys of the razor model only).
+      void SetFastToys(bool fast) { fFastToys = fast; fWarm = false; fStarted = false; }
+
+      bool IsValid() const { return fSlots.size() > 0; }
+
+      // number of threads or worker processes that run the toys, and
+      // whether they are processes (known once the test statistic is set)
+      int NWorkers() const { return (fForkWorkers) ? fNWorkers : fSlots.size(); }
+      bool ForkWorkers() const { return fForkWorkers; }
+
+      // Create an empty result to be filled by RunPoint.
+      HypoTestInverterResult * CreateResult(double cl, bool useCLs) const;
+
+      // Prepare the point poival: fit the generation points and evaluate
+      // the test statistic on the observed data.  It is done once per
+      // point (RunPoint calls it for a new point); call it for every point
+      // of a scan, in order, so that the razor fit cache is filled with
+      // the same sequence of points in every run.
+      bool StartPoint(double poival);
+
+      // Run ntoysSB toys under the S+B hypothesis and ntoysB toys under
+      // the B hypothesis at poival, using the toy indices starting from
+      // firstToySB and firstToyB.  The toys are added to the point poival
+      // of r (and merged with the ones already there).
+      bool RunPoint(double poival, int ntoysSB, int ntoysB, int firstToySB,
+                    int firstToyB, HypoTestInverterResult * r);
+
+      struct Slot;                             // per-thread workspace clone
+
+   private:
+      struct ToyOutput {                       // result of one toy
+         double value;                         // test statistic
+         double generation;                    // generation time (s)
+         double evaluation;                    // test statistic time (s)
+      };
+
+      Slot * NewSlot() const;
+      unsigned int ToySeed(double poival, int hypothesis, int toy) const;
+      void SetGenerationPoint(double poival, bool isNull);
+      void WarmUp(double poival);
+      void RunToys(Slot * slot, double poival, int firstToySB, int firstToyB,
+                   int ntoysSB, int ntoysB, int * next, int worker, int nWorkers,
+                   std::vector<ToyOutput> * toys);
+      bool RunWorkers(double poival, int firstToySB, int firstToyB,
+                      int ntoysSB, int ntoysB, std::vector<ToyOutput> & toys);
+
+      RooWorkspace * fWorkspace;               // workspace cloned by the slots (not owned)
+      const ModelConfig * fSBModel;
+      const ModelConfig * fBModel;
+      std::string fDataName;
+      int fNWorkers;                           // threads or processes requested
+      bool fForkWorkers;                       // run the toys in forked processes
+      std::vector<Slot*> fSlots;
+      RooArgSet * fNullGen;                    // POI + nuisance values used to generate S+B toys
+      RooArgSet * fAltGen;                     // POI + nuisance values used to generate B toys
+      RazorFitCache * fFitCache;               // step sizes of the razor likelihood fits, filled by slot 0
+      int fType;
+      int fNEventsPerToy;
+      bool fGenerateBinned;
+      bool fFastToys;
+      bool fWarm;
+      bool fStarted;                           // true once StartPoint has run for fPoint
+      double fPoint;                           // current scan point
+      double fObsValue;                        // test statistic of the observed data at fPoint
+      unsigned long long fSeed;
+      std::string fMinimizerType;
+      std::string fNuisPriorName;
+   };
+
+} // end namespace RooStats
+
+#endif